@@ -0,0 +1,58 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/* A blocking FIFO queue with a fixed capacity, used to hand work between
+ * the stages of the join engine. push() blocks while the queue is full and
+ * pop() blocks while it is empty. After close() no new items are accepted
+ * and pop() returns false once the remaining items have been drained. */
+template <typename T>
+class BoundedQueue
+{
+  public:
+    BoundedQueue(size_t capacity) : cap(capacity > 0 ? capacity : 1), closed(false) {}
+
+    bool push(const T & item)
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      not_full.wait(lock, [this] { return closed || items.size() < cap; });
+      if (closed)
+        return false;
+      items.push_back(item);
+      not_empty.notify_one();
+      return true;
+    }
+
+    bool pop(T & item)
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      not_empty.wait(lock, [this] { return closed || !items.empty(); });
+      if (items.empty())
+        return false;
+      item = items.front();
+      items.pop_front();
+      not_full.notify_one();
+      return true;
+    }
+
+    void close()
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      closed = true;
+      not_empty.notify_all();
+      not_full.notify_all();
+    }
+
+  private:
+    size_t cap;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mtx;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "resquecommon.h"
+#include "wktscan.h"
 #include <iostream>
 
 
@@ -9,6 +10,14 @@ ISpatialIndex * spidx = NULL;
 
 int GEOM_IDX = -1;
 
+// batch mode: the query windows and their ids
+vector<Geometry*> windows;
+vector<const PreparedGeometry*> prepared_windows;
+vector<string> window_ids;
+
+// planned mode: the tiles covered by the window (rangeplanner)
+map<long, Envelope> inside_tiles;
+
 void freeObjects() {
     // garbage collection 
     delete wkt_reader ;
@@ -17,21 +26,194 @@ void freeObjects() {
     delete storage;
 }
 
-vector<string> parse(string & line) {
-  vector<string> tokens ;
-  tokenize(line, tokens,TAB,true);
-  return tokens;
+// a rectangular query window
+Geometry * boxWindow(double min_x, double min_y, double max_x, double max_y) {
+  stringstream ss;
+  ss << shapebegin << min_x << SPACE << min_y << COMMA
+       << min_x << SPACE << max_y << COMMA
+       << max_x << SPACE << max_y << COMMA
+       << max_x << SPACE << min_y << COMMA
+       << min_x << SPACE << min_y << shapeend;
+  return wkt_reader->read(ss.str());
+}
+
+/* Loads the inside tiles of a plan written by rangeplanner, one tile per
+ * line: id TAB inside|boundary TAB min_x TAB min_y TAB max_x TAB max_y. */
+bool loadPlan(const char * filename) {
+  std::ifstream planFile(filename);
+  string input_line;
+  vector<string> fields;
+  if (!planFile)
+    return false;
+
+  while (std::getline(planFile, input_line)) {
+    fields.clear();
+    tokenize(input_line, fields, TAB, true);
+    if (fields.size() < 6 || fields[1] != "inside")
+      continue;
+    inside_tiles[strtol(fields[0].c_str(), NULL, 10)] = Envelope(
+        strtod(fields[2].c_str(), NULL), strtod(fields[4].c_str(), NULL),
+        strtod(fields[3].c_str(), NULL), strtod(fields[5].c_str(), NULL));
+  }
+  return true;
 }
 
+/* Loads the windows of a batch, one per line: either
+ * id TAB min_x TAB min_y TAB max_x TAB max_y (like a partition file)
+ * or id TAB WKT geometry, and indexes them in an R-tree. */
+bool loadWindows(const char * filename) {
+  std::ifstream windowFile(filename);
+  string input_line;
+  vector<string> fields;
+  map<int,Geometry*> geom_windows;
+  if (!windowFile)
+    return false;
+
+  try {
+    while (std::getline(windowFile, input_line)) {
+      fields.clear();
+      tokenize(input_line, fields, TAB, true);
+      Geometry * window = NULL;
+      if (fields.size() >= 5)
+        window = boxWindow(strtod(fields[1].c_str(), NULL), strtod(fields[2].c_str(), NULL),
+            strtod(fields[3].c_str(), NULL), strtod(fields[4].c_str(), NULL));
+      else if (fields.size() == 2)
+        window = wkt_reader->read(fields[1]);
+      if (window == NULL || window->isEmpty()) {
+        delete window;
+        continue;
+      }
+      geom_windows[windows.size()] = window;
+      windows.push_back(window);
+      window_ids.push_back(fields[0]);
+    }
+  }
+  catch (...) {
+    cerr << "******Window Parsing Error******" << endl;
+    return false;
+  }
+  if (windows.empty())
+    return false;
+  for (size_t k = 0; k < windows.size(); k++)
+    prepared_windows.push_back(PreparedGeometryFactory::prepare(windows[k]));
+
+  id_type indexIdentifier;
+  GEOSDataStream stream(&geom_windows);
+  storage = StorageManager::createNewMemoryStorageManager();
+  spidx = RTree::createAndBulkLoadNewRTree(RTree::BLM_STR, stream, *storage,
+      FillFactor, IndexCapacity, LeafCapacity, 2, RTree::RV_RSTAR, indexIdentifier);
+  return spidx->isIndexValid();
+}
+
+/* Batch mode: the input is scanned once for all windows. A record
+ * intersecting at least one window is written once, followed by the
+ * comma separated ids of its windows (in window file order). */
+int batchQuery() {
+  string input_line;
+  vector<field_t> fields;
+  vector<id_type> matched;
+  double low[2], high[2];
+  Geometry * geom;
+
+  cerr << "Reading input from stdin..." <<endl;
+  while(cin && getline(cin, input_line) && !cin.eof()){
+    split(input_line, fields);
+    if (GEOM_IDX >= fields.size() || fields[GEOM_IDX].len <2 )
+      continue ;  // skip lines which has empty geometry
+
+    // the MBR from the WKT text, parsing only the objects that hit a window MBR
+    geom = NULL;
+    if (scanEnvelope(fields[GEOM_IDX].ptr, fields[GEOM_IDX].len,
+          low[0], low[1], high[0], high[1]) <= 0) {
+      geom = wkt_reader->read(fields[GEOM_IDX].str());
+      if (geom->isEmpty()) {
+        delete geom;
+        continue;
+      }
+      const Envelope * env = geom->getEnvelopeInternal();
+      low[0] = env->getMinX();
+      low[1] = env->getMinY();
+      high[0] = env->getMaxX();
+      high[1] = env->getMaxY();
+    }
+
+    hits.clear();
+    Region r(low, high, 2);
+    MyVisitor vis;
+    spidx->intersectsWithQuery(r, vis);
+    if (hits.empty()) {
+      delete geom;
+      continue;
+    }
+
+    if (geom == NULL)
+      geom = wkt_reader->read(fields[GEOM_IDX].str());
+    matched.clear();
+    for (size_t k = 0; k < hits.size(); k++)
+      if (prepared_windows[hits[k]]->intersects(geom))
+        matched.push_back(hits[k]);
+    delete geom;
+    if (matched.empty())
+      continue;
+
+    std::sort(matched.begin(), matched.end());
+    cout << input_line << TAB;
+    for (size_t k = 0; k < matched.size(); k++)
+      cout << (k > 0 ? COMMA : "") << window_ids[matched[k]];
+    cout << '\n';
+  }
+  return 0;
+}
+
+
 int main(int argc, char **argv) {
   double min_x;
   double max_x;
   double min_y;
   double max_y;
 
+  // initlize the GEOS objects
+  gf = new GeometryFactory(new PrecisionModel(),0);
+  wkt_reader= new WKTReader(gf);
+
+  if (argc > 2 && strcmp(argv[1], "--plan") == 0) {
+    if (!loadPlan(argv[2])) {
+      cerr << "Plan file [" << argv[2] << "] can NOT be loaded." << endl;
+      return -1;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
+  if (argc == 4 && strcmp(argv[1], "--windows") == 0) {
+    GEOM_IDX = atoi(argv[3]);
+    if (GEOM_IDX < 1) {
+      cerr << "Invalid arguments for field indices" << endl;
+      return -1;
+    }
+    if (!loadWindows(argv[2])) {
+      cerr << "Window file [" << argv[2] << "] can NOT be loaded." << endl;
+      return -1;
+    }
+    int rc = batchQuery();
+    cout.flush();
+    cerr.flush();
+    for (size_t k = 0; k < prepared_windows.size(); k++)
+      PreparedGeometryFactory::destroy(prepared_windows[k]);
+    for (size_t k = 0; k < windows.size(); k++)
+      delete windows[k];
+    freeObjects();
+    return rc;
+  }
+
   if (argc < 6) {
 	cerr << "Usage: "<< argv[0] << " [min_x] [min_y] [max_x] [max_y] [geomid] [filename]" << endl;
         cerr << " filename is optional - the file should contain a geometry of the range query " << endl;
+	cerr << "       "<< argv[0] << " --plan [plan file] [min_x] [min_y] [max_x] [max_y] [geomid] [filename]" << endl;
+        cerr << " planned mode - the tiles of the plan file (rangeplanner) covered by the window are not tested" << endl;
+	cerr << "       "<< argv[0] << " --windows [window file] [geomid]" << endl;
+        cerr << " batch mode - every line of the window file is a query window: id, min_x, min_y, max_x, max_y "
+             << "or id, WKT geometry (tab separated). Records are tagged with the ids of their windows." << endl;
         return -1;
   }
 
@@ -41,24 +223,13 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  // initlize the GEOS objects
-  gf = new GeometryFactory(new PrecisionModel(),0);
-  wkt_reader= new WKTReader(gf);
-
   Geometry* window;
   if (argc == 6) {
-    stringstream ss;
     min_x = strtod(argv[1], NULL);
     min_y = strtod(argv[2], NULL);
     max_x = strtod(argv[3], NULL);
     max_y = strtod(argv[4], NULL);
-
-    ss << shapebegin << min_x << SPACE << min_y << COMMA
-         << min_x << SPACE << max_y << COMMA
-         << max_x << SPACE << max_y << COMMA
-         << max_x << SPACE << min_y << COMMA
-         << min_x << SPACE << min_y << shapeend;
-     window = wkt_reader->read(ss.str());
+    window = boxWindow(min_x, min_y, max_x, max_y);
   } else {
      std::ifstream windowFile(argv[6]);
      string input;
@@ -70,33 +241,72 @@ int main(int argc, char **argv) {
   //
   map<int,Geometry*> geom_polygons;
   string input_line;
-  vector<string> fields;
+  vector<field_t> fields;
   cerr << "Reading input from stdin..." <<endl; 
   id_type id ; 
   Geometry* geom; 
-  const Envelope * env;
+  Envelope obj_env;
+  const Envelope * window_env = window->getEnvelopeInternal();
+  // a rectangular window contains every object whose MBR it contains
+  bool rect_window = window->isRectangle();
+  const PreparedGeometry * prepared_window = PreparedGeometryFactory::prepare(window);
+  double min_x_obj, min_y_obj, max_x_obj, max_y_obj;
 
 
   while(cin && getline(cin, input_line) && !cin.eof()){
-    fields = parse(input_line);
+    split(input_line, fields);
     //if (fields[ID_IDX].length() <1 )
     //  continue ;  // skip lines which has empty id field 
     // id = std::strtoul(fields[ID_IDX].c_str(), NULL, 0);
 
-    if (fields[GEOM_IDX].length() <2 )
+    if (GEOM_IDX >= fields.size() || fields[GEOM_IDX].len <2 )
     {
 #ifndef NDEBUG
       cerr << "skipping record [" << id <<"]"<< endl;
 #endif
       continue ;  // skip lines which has empty geometry
     }
-    // try {
-    geom = wkt_reader->read(fields[GEOM_IDX]);
-    if (geom->intersects(window)) {
-        cout << input_line << endl;
+    // the MBR from the WKT text, parsing only when it can not be scanned
+    geom = NULL;
+    if (scanEnvelope(fields[GEOM_IDX].ptr, fields[GEOM_IDX].len,
+          min_x_obj, min_y_obj, max_x_obj, max_y_obj) > 0) {
+      obj_env.init(min_x_obj, max_x_obj, min_y_obj, max_y_obj);
+    } else {
+      geom = wkt_reader->read(fields[GEOM_IDX].str());
+      if (geom->isEmpty()) {
+        delete geom;
+        continue;
+      }
+      obj_env = *geom->getEnvelopeInternal();
+    }
+
+    // objects whose MBR misses the window are rejected, objects whose MBR
+    // lies in the window (if rectangular) or in a tile covered by the
+    // window are accepted, without a geometry test
+    bool inside = false;
+    if (!window_env->intersects(&obj_env)) {
+      delete geom;
+      continue;
+    }
+    if (rect_window && window_env->covers(&obj_env))
+      inside = true;
+    else if (!inside_tiles.empty()) {
+      map<long, Envelope>::const_iterator tile = inside_tiles.find(strtol(fields[0].ptr, NULL, 10));
+      inside = tile != inside_tiles.end() && tile->second.covers(&obj_env);
+    }
+
+    if (!inside) {
+      if (geom == NULL)
+        geom = wkt_reader->read(fields[GEOM_IDX].str());
+      inside = prepared_window->intersects(geom);
     }
+    delete geom;
+    if (inside)
+      cout << input_line << endl;
   }
 
+  PreparedGeometryFactory::destroy(prepared_window);
+  delete window;
   cout.flush();
   cerr.flush();
   freeObjects();
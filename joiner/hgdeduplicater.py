@@ -23,6 +23,54 @@ def uniq2():
             print line
             prev = joinRes
 
+# adds up the counts (last field) of consecutive lines with the same key,
+# usable as combiner and reducer for the resque count outputs. Lines with
+# only a count are added up to a single total.
+def sumcounts():
+    prev = None
+    total = 0
+    for line in sys.stdin:
+        line = line.rstrip('\n')
+        if not line:
+            continue
+        fields = line.rsplit('\t', 1)
+        key = fields[0] if len(fields) > 1 else ''
+        if key != prev:
+            if prev is not None:
+                printcount(prev, total)
+            prev = key
+            total = 0
+        total += int(fields[-1])
+    if prev is not None:
+        printcount(prev, total)
+
+def printcount(key, total):
+    if key:
+        print key + '\t' + str(total)
+    else:
+        print str(total)
+
+# resque --mode anti: keeps the rows of which all copies (the key before
+# the last field) end with 0, no tile found a match for them. The last
+# field may also be a sum of such flags (a "sum" combiner).
+def anti():
+    prev = None
+    matched = False
+    for line in sys.stdin:
+        line = line.rstrip('\n')
+        if not line:
+            continue
+        key, flag = line.rsplit('\t', 1)
+        if key != prev:
+            if prev is not None and not matched:
+                print prev
+            prev = key
+            matched = False
+        if int(flag) != 0:
+            matched = True
+    if prev is not None and not matched:
+        print prev
+
 def sort():
     lines = []
     for line in sys.stdin:
@@ -35,7 +83,7 @@ def sort():
 
 def main():
     if len(sys.argv) < 2:
-        sys.stderr.write("Usage: "+ sys.argv[0] + "[ cat | sort | uniq | uniq2 ]\n")
+        sys.stderr.write("Usage: "+ sys.argv[0] + "[ cat | sort | uniq | uniq2 | sum | anti ]\n")
         sys.exit(1)
     cmd = sys.argv[1].lower()
 
@@ -47,6 +95,10 @@ def main():
         sort()
     elif cmd == "uniq2":
         uniq2()
+    elif cmd == "sum":
+        sumcounts()
+    elif cmd == "anti":
+        anti()
     else:
         sys.stderr.write("Unknown option: [" + cmd + "]\n")
 
@@ -0,0 +1,168 @@
+#ifndef PACKEDINDEX_H
+#define PACKEDINDEX_H
+
+#include <stdint.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/* Static R-tree over a set of boxes, bulk loaded with Sort-Tile-Recursive
+ * and stored without pointers: the boxes of all levels follow each other
+ * in one array, leaves first, and the children of node k of a level are
+ * the nodes k * node_size .. k * node_size + node_size - 1 of the level
+ * below. The serialized tree is
+ *
+ *   uint32  number of items, node size, number of levels, 0
+ *   uint64  end of each level in the box array
+ *   double  min_x, min_y, max_x, max_y of every box
+ *   uint32  item id of every leaf box
+ *
+ * and is queried in place (from a file mapped in memory), read only. */
+struct packed_box {
+  double min_x;
+  double min_y;
+  double max_x;
+  double max_y;
+};
+
+class PackedRTree
+{
+  public:
+    PackedRTree() : count(0), node_size(0), levels(0), level_end(NULL), boxes(NULL), ids(NULL) {}
+
+    /* Packs items (item k gets id k) into a tree serialized at the end
+     * of out. The size of the serialized tree is a multiple of 8. */
+    static void pack(const std::vector<packed_box> & items, uint32_t node_size, std::string & out)
+    {
+      std::vector<uint32_t> order(items.size());
+      for (size_t k = 0; k < order.size(); k++)
+        order[k] = k;
+      if (node_size < 2)
+        node_size = 2;
+
+      // leaves: vertical slices sorted by x, each sorted by y
+      size_t leaves = (items.size() + node_size - 1) / node_size;
+      size_t slices = (size_t) ceil(sqrt((double) leaves));
+      size_t slice_len = slices > 0 ? ((leaves + slices - 1) / slices) * node_size : 1;
+      std::sort(order.begin(), order.end(), CenterLess(items, true));
+      for (size_t k = 0; k < order.size(); k += slice_len)
+        std::sort(order.begin() + k, order.begin() + std::min(k + slice_len, order.size()),
+            CenterLess(items, false));
+
+      std::vector<packed_box> tree;
+      std::vector<uint64_t> ends;
+      for (size_t k = 0; k < order.size(); k++)
+        tree.push_back(items[order[k]]);
+      ends.push_back(tree.size());
+
+      // upper levels: consecutive nodes of the level below
+      size_t begin = 0;
+      while (ends.back() - begin > 1) {
+        size_t end = ends.back();
+        for (size_t k = begin; k < end; k += node_size) {
+          packed_box box = tree[k];
+          for (size_t c = k + 1; c < std::min(k + node_size, end); c++)
+            expand(box, tree[c]);
+          tree.push_back(box);
+        }
+        begin = end;
+        ends.push_back(tree.size());
+      }
+
+      uint32_t header[4] = { (uint32_t) items.size(), node_size, (uint32_t) ends.size(), 0 };
+      out.append(reinterpret_cast<const char*>(header), sizeof(header));
+      out.append(reinterpret_cast<const char*>(&ends[0]), ends.size() * sizeof(uint64_t));
+      if (!tree.empty())
+        out.append(reinterpret_cast<const char*>(&tree[0]), tree.size() * sizeof(packed_box));
+      if (!order.empty())
+        out.append(reinterpret_cast<const char*>(&order[0]), order.size() * sizeof(uint32_t));
+      if (order.size() % 2 == 1)
+        out.append(sizeof(uint32_t), '\0');
+    }
+
+    /* Uses the serialized tree at data (8 byte aligned), which must stay
+     * valid as long as the tree is queried. Returns false when the tree
+     * does not fit in len bytes. */
+    bool attach(const char * data, size_t len)
+    {
+      const uint32_t * header = reinterpret_cast<const uint32_t*>(data);
+      if (len < 4 * sizeof(uint32_t))
+        return false;
+      count = header[0];
+      node_size = header[1];
+      levels = header[2];
+      level_end = reinterpret_cast<const uint64_t*>(data + 4 * sizeof(uint32_t));
+      if (levels == 0 || node_size < 2 || len < 4 * sizeof(uint32_t) + levels * sizeof(uint64_t))
+        return false;
+      boxes = reinterpret_cast<const packed_box*>(level_end + levels);
+      ids = reinterpret_cast<const uint32_t*>(boxes + level_end[levels - 1]);
+      return level_end[0] == count
+          && (const char*) (ids + count) <= data + len;
+    }
+
+    size_t size() const { return count; }
+
+    // appends the ids of the items whose box intersects q
+    template <class T>
+    void query(const packed_box & q, std::vector<T> & hits) const
+    {
+      if (count == 0)
+        return;
+      // (level, node) pairs left to visit, from the root
+      std::vector<std::pair<uint32_t, uint64_t> > stack;
+      stack.push_back(std::make_pair(levels - 1, level_end[levels - 1] - 1));
+      while (!stack.empty()) {
+        uint32_t level = stack.back().first;
+        uint64_t node = stack.back().second;
+        stack.pop_back();
+        if (!intersects(boxes[node], q))
+          continue;
+        if (level == 0) {
+          hits.push_back(ids[node]);
+          continue;
+        }
+        uint64_t first = levelBegin(level - 1) + (node - levelBegin(level)) * node_size;
+        uint64_t last = std::min(first + node_size, level_end[level - 1]);
+        for (uint64_t c = first; c < last; c++)
+          stack.push_back(std::make_pair(level - 1, c));
+      }
+    }
+
+  private:
+    struct CenterLess {
+      CenterLess(const std::vector<packed_box> & items, bool by_x) : items(items), by_x(by_x) {}
+      bool operator()(uint32_t a, uint32_t b) const
+      {
+        const packed_box & p = items[a];
+        const packed_box & q = items[b];
+        return by_x ? p.min_x + p.max_x < q.min_x + q.max_x : p.min_y + p.max_y < q.min_y + q.max_y;
+      }
+      const std::vector<packed_box> & items;
+      bool by_x;
+    };
+
+    static void expand(packed_box & box, const packed_box & other)
+    {
+      box.min_x = std::min(box.min_x, other.min_x);
+      box.min_y = std::min(box.min_y, other.min_y);
+      box.max_x = std::max(box.max_x, other.max_x);
+      box.max_y = std::max(box.max_y, other.max_y);
+    }
+
+    static bool intersects(const packed_box & a, const packed_box & b)
+    {
+      return a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y;
+    }
+
+    uint64_t levelBegin(uint32_t level) const { return level > 0 ? level_end[level - 1] : 0; }
+
+    uint32_t count;
+    uint32_t node_size;
+    uint32_t levels;
+    const uint64_t * level_end;
+    const packed_box * boxes;
+    const uint32_t * ids;
+};
+
+#endif
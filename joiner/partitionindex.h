@@ -0,0 +1,185 @@
+#ifndef PARTITIONINDEX_H
+#define PARTITIONINDEX_H
+
+#include <fstream>
+#include <sstream>
+#include <climits>
+#include <algorithm>
+
+/* Read-only lookup structure over the tile boundaries of a partition file
+ * (id TAB min_x TAB min_y TAB max_x TAB max_y per line). Tiles are
+ * registered in the cells of a uniform grid laid over the partitioned
+ * space, so point and box lookups only scan a few tiles. The structure
+ * is never modified after load(), so join threads can share it. */
+class PartitionIndex
+{
+  public:
+    PartitionIndex() : cells_x(0), cells_y(0), cell_w(0), cell_h(0) {}
+
+    bool load(const char * filename)
+    {
+      std::ifstream partFile(filename);
+      string input_line;
+      vector<string> fields;
+      if (!partFile)
+        return false;
+
+      while (std::getline(partFile, input_line)) {
+        tokenize(input_line, fields, TAB, true);
+        if (fields.size() < 5)
+          continue;
+        long id = strtol(fields[0].c_str(), NULL, 10);
+        pos[id] = ids.size();
+        ids.push_back(id);
+        names.push_back(fields[0]);
+        boxes.push_back(Envelope(boundary(fields[1]), boundary(fields[3]),
+              boundary(fields[2]), boundary(fields[4])));
+        space.expandToInclude(&boxes.back());
+        fields.clear();
+      }
+      if (ids.empty())
+        return false;
+
+      // roughly one tile per grid cell
+      cells_x = cells_y = (int) ceil(sqrt((double) ids.size()));
+      cell_w = space.getWidth() / cells_x;
+      cell_h = space.getHeight() / cells_y;
+      cells.resize(cells_x * cells_y);
+      for (size_t k = 0; k < boxes.size(); k++) {
+        int x1, y1, x2, y2;
+        cellRange(&boxes[k], x1, y1, x2, y2);
+        for (int x = x1; x <= x2; x++)
+          for (int y = y1; y <= y2; y++)
+            cells[x * cells_y + y].push_back(k);
+      }
+      return true;
+    }
+
+    bool empty() const { return ids.empty(); }
+
+    // boundary of a tile, NULL if the tile is not in the partition file
+    const Envelope * find(long id) const
+    {
+      map<long, size_t>::const_iterator it = pos.find(id);
+      return it == pos.end() ? NULL : &boxes[it->second];
+    }
+
+    // the id of a tile as written in the partition file (data/ path component)
+    const string & name(long id) const
+    {
+      return names[pos.find(id)->second];
+    }
+
+    // ids of the tiles intersecting env, in increasing order
+    void intersecting(const Envelope * env, vector<long> & found) const
+    {
+      found.clear();
+      if (ids.empty() || !env->intersects(&space))
+        return;
+
+      int x1, y1, x2, y2;
+      cellRange(env, x1, y1, x2, y2);
+      for (int x = x1; x <= x2; x++) {
+        for (int y = y1; y <= y2; y++) {
+          const vector<size_t> & cell = cells[x * cells_y + y];
+          for (size_t k = 0; k < cell.size(); k++)
+            if (boxes[cell[k]].intersects(env))
+              found.push_back(ids[cell[k]]);
+        }
+      }
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+    }
+
+    /* The tile that reports a pair of objects with MBRs env1 and env2.
+     * The mapper copies an object to every tile its MBR intersects, so
+     * the pair is present in each tile intersecting both MBRs. Among those
+     * the owner is the tile with the smallest id that contains the lower
+     * left corner of the MBR intersection. When the MBRs are disjoint
+     * (st_dwithin) or the corner falls outside every tile, it is the tile
+     * with the smallest id intersecting both MBRs. Returns LONG_MAX when
+     * no tile qualifies. */
+    long owner(const Envelope * env1, const Envelope * env2) const
+    {
+      long best = LONG_MAX;
+      if (ids.empty())
+        return best;
+
+      if (env1->intersects(env2)) {
+        double x = std::max(env1->getMinX(), env2->getMinX());
+        double y = std::max(env1->getMinY(), env2->getMinY());
+        Envelope corner(x, x, y, y);
+        best = smallestId(&corner, NULL);
+        if (best != LONG_MAX)
+          return best;
+      }
+      return smallestId(env1, env2);
+    }
+
+  private:
+    // tile boundaries go through the same text formatting as in the
+    // partition mappers, so both sides assign objects to identical tiles
+    static double boundary(const string & field)
+    {
+      std::stringstream ss;
+      ss << strtod(field.c_str(), NULL);
+      return strtod(ss.str().c_str(), NULL);
+    }
+
+    void cellRange(const Envelope * env, int & x1, int & y1, int & x2, int & y2) const
+    {
+      x1 = cellOf(env->getMinX() - space.getMinX(), cell_w, cells_x);
+      x2 = cellOf(env->getMaxX() - space.getMinX(), cell_w, cells_x);
+      y1 = cellOf(env->getMinY() - space.getMinY(), cell_h, cells_y);
+      y2 = cellOf(env->getMaxY() - space.getMinY(), cell_h, cells_y);
+    }
+
+    // clamped in double before the conversion to int
+    static int cellOf(double offset, double width, int count)
+    {
+      if (!(width > 0))
+        return 0;
+      double q = offset / width;
+      if (!(q > 0))
+        return 0;
+      if (q >= count)
+        return count - 1;
+      return (int) q;
+    }
+
+    // smallest id of the tiles intersecting env1 (and env2 if given)
+    long smallestId(const Envelope * env1, const Envelope * env2) const
+    {
+      long best = LONG_MAX;
+      if (!env1->intersects(&space))
+        return best;
+
+      int x1, y1, x2, y2;
+      cellRange(env1, x1, y1, x2, y2);
+      for (int x = x1; x <= x2; x++) {
+        for (int y = y1; y <= y2; y++) {
+          const vector<size_t> & cell = cells[x * cells_y + y];
+          for (size_t k = 0; k < cell.size(); k++) {
+            size_t t = cell[k];
+            if (ids[t] < best && boxes[t].intersects(env1)
+                && (env2 == NULL || boxes[t].intersects(env2)))
+              best = ids[t];
+          }
+        }
+      }
+      return best;
+    }
+
+    vector<long> ids;
+    vector<string> names;
+    vector<Envelope> boxes;
+    map<long, size_t> pos;
+    Envelope space;
+    int cells_x;
+    int cells_y;
+    double cell_w;
+    double cell_h;
+    vector< vector<size_t> > cells;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "resquecommon.h"
+#include <fstream>
+#include <sstream>
+#include "partitionindex.h"
+
+/* Plans a range query over a loaded data set: classifies every tile of the
+ * partition file against the exact query window, instead of its MBR:
+ *
+ *   inside   - the window covers the tile
+ *   boundary - the window intersects the tile but does not cover it
+ *
+ * Tiles the window does not intersect hold no result and are left out.
+ * One line per tile: id TAB inside|boundary TAB min_x TAB min_y TAB max_x
+ * TAB max_y, the tile boundary as the partition mappers use it. The plan is
+ * passed to containment --plan, which writes the records lying inside an
+ * inside tile without parsing them. */
+
+GeometryFactory *gf = NULL;
+WKTReader *wkt_reader = NULL;
+
+// a rectangular window or tile
+Geometry * boxGeometry(double min_x, double min_y, double max_x, double max_y) {
+  stringstream ss;
+  ss << shapebegin << min_x << SPACE << min_y << COMMA
+       << min_x << SPACE << max_y << COMMA
+       << max_x << SPACE << max_y << COMMA
+       << max_x << SPACE << min_y << COMMA
+       << min_x << SPACE << min_y << shapeend;
+  return wkt_reader->read(ss.str());
+}
+
+int plan(const PartitionIndex & partitions, const Geometry * window) {
+  vector<long> tiles;
+  int count = 0;
+  const PreparedGeometry * prepared = PreparedGeometryFactory::prepare(window);
+
+  partitions.intersecting(window->getEnvelopeInternal(), tiles);
+  for (size_t k = 0; k < tiles.size(); k++) {
+    const Envelope * box = partitions.find(tiles[k]);
+    Geometry * tile = boxGeometry(box->getMinX(), box->getMinY(), box->getMaxX(), box->getMaxY());
+    const char * kind = NULL;
+    if (prepared->covers(tile))
+      kind = "inside";
+    else if (prepared->intersects(tile))
+      kind = "boundary";
+    delete tile;
+    if (kind == NULL)
+      continue;
+
+    cout << partitions.name(tiles[k]) << TAB << kind << TAB << box->getMinX() << TAB << box->getMinY()
+      << TAB << box->getMaxX() << TAB << box->getMaxY() << endl;
+    count++;
+  }
+  PreparedGeometryFactory::destroy(prepared);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 6) {
+    cerr << "Usage: "<< argv[0] << " [partition file] [min_x] [min_y] [max_x] [max_y] [filename]" << endl;
+    cerr << " filename is optional - the file should contain a geometry of the range query "
+         << "(the box arguments are then ignored)" << endl;
+    return -1;
+  }
+
+  gf = new GeometryFactory(new PrecisionModel(),0);
+  wkt_reader = new WKTReader(gf);
+
+  PartitionIndex partitions;
+  if (!partitions.load(argv[1])) {
+    cerr << "Partition file [" << argv[1] << "] can NOT be loaded." << endl;
+    return -1;
+  }
+
+  Geometry * window = NULL;
+  try {
+    if (argc == 6) {
+      window = boxGeometry(strtod(argv[2], NULL), strtod(argv[3], NULL),
+          strtod(argv[4], NULL), strtod(argv[5], NULL));
+    } else {
+      std::ifstream windowFile(argv[6]);
+      string input;
+      std::getline(windowFile, input);
+      window = wkt_reader->read(input);
+    }
+  }
+  catch (...) {
+    cerr << "******Window Parsing Error******" << endl;
+    return -1;
+  }
+
+  int tiles = window->isEmpty() ? 0 : plan(partitions, window);
+  cerr << "Planned tiles: [" << tiles << "]" << endl;
+
+  cout.flush();
+  delete window;
+  delete wkt_reader;
+  delete gf;
+  return 0;
+}
@@ -1,19 +1,159 @@
 #include "resquecommon.h"
+#include "boundedqueue.h"
+#include "partitionindex.h"
+#include "tilearena.h"
+#include "resultbuffer.h"
+#include "wktscan.h"
+#include "spillfile.h"
+#include "tilerecord.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
+
+// filter step implementations
+const int FILTER_RTREE = 1;
+const int FILTER_SWEEP = 2;
+const int FILTER_AUTO = 3;
+// with --filter auto, tiles up to this many objects use the plane sweep
+const int SWEEP_LIMIT = 20000;
+
+// output formats of a joined pair
+const int OUTPUT_FULL = 1;  // the projected fields of both objects
+const int OUTPUT_IDS = 2;   // only the first projected field (object id) of both objects
+const int OUTPUT_COUNT = 3; // no pairs, the number of pairs of each tile
+const int OUTPUT_COUNT_LEFT = 4;  // no pairs, the number of matches of each object of set 1
+
+// join modes
+const int JOIN_PAIRS = 0;  // the matching pairs
+const int JOIN_SEMI = 1;   // the objects of set 1 with a match
+const int JOIN_ANTI = 2;   // the objects of set 1 without a match
+
+// self-join evaluation of symmetric predicates
+const int SYMMETRIC_OFF = 0;   // every ordered pair is refined on its own
+const int SYMMETRIC_ONCE = 1;  // each unordered pair is refined and reported once
+const int SYMMETRIC_BOTH = 2;  // refined once, reported in both orientations
+
+/* Memory estimate of an object for --mem-limit, besides its WKT or WKB
+ * (counted twice: the text and the parsed coordinates) and its output row:
+ * the tile object, filter entries and the GEOS geometry headers. */
+const size_t OBJECT_OVERHEAD = 256;
 
 // data type declaration 
-map<int, std::vector<Geometry*> > polydata;
-map<int, std::vector<string> > rawdata;
-ISpatialIndex * spidx = NULL;
-IStorageManager * storage = NULL;
+/* An object of a tile. The MBR is scanned from the WKT text when the
+ * record is loaded (or read from a binary record); the geometry is parsed
+ * only when the object is part of a candidate pair, at most once. */
+struct tile_object {
+  Envelope env;
+  const char * shape; // WKT, or WKB with --binary, in the tile arena
+  size_t shape_len;
+  Geometry * geom;    // NULL until parsed
+  double area;        // area of the geometry for --stats, -1 until computed
+};
+
+/* Time spent in each stage of a tile (seconds) and the filter
+ * candidates, for --profile */
+struct tile_profile {
+  double parse_time;   // record splitting, MBR scan and WKT parsing
+  double index_time;   // R-tree build or sorting for the plane sweep
+  double filter_time;  // R-tree queries or the sweep itself
+  double refine_time;  // exact predicates
+  double output_time;  // formatting and writing the joined pairs
+  long candidates;     // pairs that passed the MBR filter
+};
+
+/* The objects of one tile (bucket) that are joined together */
+struct tile_bucket {
+  string tile_id;
+  map<int, std::vector<tile_object> > polydata;
+  // geometries are parsed on demand with the factory of the tile
+  const GeometryFactory * factory;
+  // projected output rows, stored in the arena
+  map<int, std::vector<const char*> > rawdata;
+  // per tile memory: output rows and filter structures, reset at tile end
+  TileArena arena;
+  // filter step used for the tile and the stage timings
+  int filter;
+  tile_profile prof;
+  // estimated memory of the loaded objects, and the objects of each set
+  // moved to the spill files when the tile exceeds --mem-limit
+  size_t bytes;
+  long spilled[3];
+  // the sets hold blocks of a spilled tile, base1 and base2 are the
+  // positions of the first objects of the blocks in the tile
+  bool block;
+  long base1;
+  long base2;
+
+  tile_bucket() : factory(NULL), filter(0), prof(), bytes(0), block(false), base1(0), base2(0)
+  {
+    spilled[0] = spilled[1] = spilled[2] = 0;
+  }
+};
+
+/* MBR of an object for the plane sweep filter */
+struct sweep_entry {
+  double min_x, min_y, max_x, max_y;
+  int id;
+  bool operator<(const sweep_entry & other) const { return min_x < other.min_x; }
+};
+
+/* candidate pairs (probe, candidate) of the filter step. The list grows
+ * by doubling and is kept on the heap: in the tile arena every outgrown
+ * buffer would stay allocated until the end of the tile. */
+typedef vector< pair<int,int> > candidate_list;
+
+/* A tile travelling through the pipeline: raw input lines from the
+ * reader, geometries from the parser, joined text from the join stage.
+ * Each batch has its own geometry factory because its geometries are
+ * created and destroyed on different threads. */
+struct tile_batch {
+  long seq;
+  vector<string> lines;
+  tile_bucket bucket;
+  PrecisionModel * pm;
+  GeometryFactory * gf;
+  ResultBuffer result;
+  string info;
+  string profile;
+  bool failed;
+};
 
 bool appendstats = false;
 bool appendTileID = false;
-double area1 = -1;
-double area2 = -1;
-double union_area = -1;
-double intersect_area = -1;
-string tile_id = "";
-string previd = "";
+// the statistics of the pair being refined, one set per worker thread
+thread_local double area1 = -1;
+thread_local double area2 = -1;
+thread_local double union_area = -1;
+thread_local double intersect_area = -1;
+
+// per tile profile records (JSON lines) when --profile is given
+std::ofstream profile_file;
+bool profiling = false;
+
+// tile boundaries for duplicate avoidance (empty when not given)
+PartitionIndex partitions;
+
+// seconds elapsed since start
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// engine parameters
+int num_threads = 0;
+int num_parsers = 1;
+bool ordered_output = true;
+int filter_method = FILTER_AUTO;
+int output_mode = OUTPUT_FULL;
+int join_mode = JOIN_PAIRS;
+int symmetric_mode = SYMMETRIC_OFF;
+int tile_threads = 0;
+int split_threshold = 50000;
+size_t mem_limit = 0;   // bytes per tile, 0 for no limit
+const size_t OUTPUT_FLUSH_BYTES = 1 << 20;  // output buffered by the sequential path
+bool binary_input = false;  // tile records of partitionMapperJoin --binary
 
 struct query_op { 
   int JOIN_PREDICATE;
@@ -27,15 +167,20 @@ struct query_op {
 
 void init();
 void print_stop();
-int joinBucket();
+int joinBucket(tile_bucket & b, ResultBuffer & out);
+int joinTile(tile_bucket & b, SpillFile * spill, ResultBuffer & out);
+bool spillBucket(tile_bucket & b, SpillFile * spill);
 int mJoinQuery(); 
-void releaseShapeMem(const int k);
+int mJoinQueryThreaded();
+int loadRecord(tile_bucket & b, vector<field_t> & fields);
+void releaseShapeMem(tile_bucket & b, const int k);
 int getJoinPredicate(char * predicate_str);
 void setProjectionParam(char * arg);
 bool extractParams(int argc, char** argv );
-void ReportResult( int i , int j);
-string project( vector<string> & fields, int sid);
-void freeObjects();
+void ReportResult(tile_bucket & b, const char * row1, const char * row2, ResultBuffer & out);
+void reportTile(tile_bucket & b, int pairs, ostream & info);
+void profileTile(tile_bucket & b, int pairs, ostream & os);
+const char * project( vector<field_t> & fields, int sid, TileArena & arena);
 
 void init(){
   // initlize query operator 
@@ -53,116 +198,442 @@ void print_stop(){
   std::cerr << "shape index 1: " << stop.shape_idx_1 << std::endl;
   std::cerr << "shape index 2: " << stop.shape_idx_2 << std::endl;
   std::cerr << "join cardinality: " << stop.join_cardinality << std::endl;
+  std::cerr << "threads: " << num_threads << std::endl;
+  std::cerr << "parsers: " << num_parsers << std::endl;
+  std::cerr << "filter: " << (filter_method == FILTER_SWEEP ? "sweep" : filter_method == FILTER_RTREE ? "rtree" : "auto") << std::endl;
+  const char * outputs[] = { "", "full", "ids", "count", "count-per-left" };
+  std::cerr << "output: " << outputs[output_mode] << std::endl;
+  const char * modes[] = { "join", "semi", "anti" };
+  std::cerr << "mode: " << modes[join_mode] << std::endl;
+  std::cerr << "symmetric: " << (symmetric_mode == SYMMETRIC_ONCE ? "once" : symmetric_mode == SYMMETRIC_BOTH ? "both" : "off") << std::endl;
+  std::cerr << "tile threads: " << tile_threads << std::endl;
+  std::cerr << "split threshold: " << split_threshold << std::endl;
+  std::cerr << "memory limit: " << (mem_limit >> 20) << "MB" << std::endl;
+  std::cerr << "input: " << (binary_input ? "binary" : "text") << std::endl;
+}
+
+// adds an object to a set of the bucket, its geometry is copied to the arena
+void addObject(tile_bucket & b, int sid, double min_x, double min_y, double max_x, double max_y,
+    const char * shape, size_t shape_len, const char * row, TileArena & arena)
+{
+  tile_object obj;
+  obj.env.init(min_x, max_x, min_y, max_y);
+  obj.shape = arena.copy(shape, shape_len);
+  obj.shape_len = shape_len;
+  obj.geom = NULL;
+  obj.area = -1;
+  b.polydata[sid].push_back(obj);
+  b.rawdata[sid].push_back(row);
+  b.bytes += 2 * shape_len + strlen(row) + OBJECT_OVERHEAD;
+}
+
+/* Load one input record into the bucket. Only the MBR of the geometry
+ * is computed here, the WKT text is kept for parsing on demand.
+ * Returns 1 if the object was added, 0 if it was skipped
+ * (empty geometry) and -1 on ill formatted data. */
+int loadRecord(tile_bucket & b, vector<field_t> & fields)
+{
+  int sid = fields.size() > 1 ? strtol(fields[1].ptr, NULL, 10) : 0;
+  int index = -1; 
+  double min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+
+  switch(sid){
+    case SID_1:
+      index = stop.shape_idx_1 ; 
+      break;
+    case SID_2:
+      index = stop.shape_idx_2 ; 
+      break;
+    default:
+      std::cerr << "wrong sid : " << sid << endl;
+      return -1;
+  }
+
+  if (index >= fields.size()) {
+    std::cerr << "missing geometry field : " << index << endl;
+    return -1;
+  }
+  if (fields[index].len < 4) // this number 4 is really arbitrary
+    return 0 ; // empty spatial object 
+
+  switch (scanEnvelope(fields[index].ptr, fields[index].len, min_x, min_y, max_x, max_y)) {
+    case 0:
+      return 0 ; // empty spatial object
+    case -1:
+      std::cerr << "******Geometry Parsing Error******" << std::endl;
+      return -1;
+  }
+
+  // populate the bucket for join 
+  addObject(b, sid, min_x, min_y, max_x, max_y, fields[index].ptr, fields[index].len,
+      project(fields,sid,b.arena), b.arena);
+  return 1;
+}
+
+/* Load one binary tile record (see tilerecord.h) into the bucket. The
+ * MBR comes with the record and the geometry is kept as WKB. The output
+ * row is projected from the payload fields, laid out like a text record
+ * behind the tile id and the join index. Returns like loadRecord(). */
+int loadBinaryRecord(tile_bucket & b, const string & record, vector<field_t> & fields)
+{
+  static const char * join_ids[] = { "0", "1", "2" };
+  tile_record r;
+
+  if (!readTileRecord(record, r)) {
+    std::cerr << "******Truncated binary record******" << std::endl;
+    return -1;
+  }
+  if (r.join_idx != SID_1 && r.join_idx != SID_2) {
+    std::cerr << "wrong sid : " << r.join_idx << endl;
+    return -1;
+  }
+  if (r.shape_len == 0)
+    return 0 ; // empty spatial object
+
+  split(r.payload, r.payload_len, fields);
+  fields.insert(fields.begin(), 2, field_t());
+  fields[0].ptr = b.tile_id.data();
+  fields[0].len = b.tile_id.size();
+  fields[1].ptr = join_ids[r.join_idx];
+  fields[1].len = 1;
+
+  addObject(b, r.join_idx, r.mbr[0], r.mbr[1], r.mbr[2], r.mbr[3], r.shape, r.shape_len,
+      project(fields, r.join_idx, b.arena), b.arena);
+  return 1;
+}
+
+// loads a record of the bucket tile, text or binary
+int loadInput(tile_bucket & b, const string & record, vector<field_t> & fields)
+{
+  if (binary_input)
+    return loadBinaryRecord(b, record, fields);
+  split(record, fields);
+  return loadRecord(b, fields);
+}
+
+/* Reads the next input record and its tile id: a text line, or with
+ * --binary a pair of rawbytes frames (tile id, tile record). */
+bool readRecord(std::istream & in, string & tile_id, string & record)
+{
+  if (binary_input)
+    return readFrame(in, tile_id) && readFrame(in, record);
+  if (!in || !getline(in, record) || in.eof())
+    return false;
+  tile_id.assign(record, 0, record.find(TAB));
+  return true;
 }
 
 int mJoinQuery()
 {
   string input_line;
-  string value;
-  vector<string> fields;
-  int sid = 0;
+  string tile_id;
+  vector<field_t> fields;
+  tile_bucket bucket;
+  ResultBuffer out;
+  // results are written in input order here, so a full buffer can go out mid-tile
+  out.setSink(&cout, OUTPUT_FLUSH_BYTES);
+  // files of the current tile once it is over --mem-limit
+  SpillFile spill[2];
+  std::chrono::steady_clock::time_point start;
 
   PrecisionModel *pm = new PrecisionModel();
   GeometryFactory *gf = new GeometryFactory(pm,OSM_SRID);
-  WKTReader *wkt_reader = new WKTReader(gf);
-  Geometry *poly = NULL;
+  bucket.factory = gf;
 
   int tile_counter =0;
 
   std::cerr << "Bucketinfo:[ID] |A|x|B|=|R|" <<std::endl;
-  int index = -1; 
-  while(cin && getline(cin, input_line) && !cin.eof()) {
-    tokenize(input_line, fields, TAB, true);
-    sid = atoi(fields[1].c_str());
-    tile_id = fields[0];
-    // object_id = fields[2];
-    // cerr << "fields[0] = " << fields[0] << endl; 
-    // cerr << "fields[1] = " << fields[1] << endl; 
-    // cerr << "fields[2] = " << fields[2] << endl; 
-    // cerr << "fields[9] = " << fields[9] << endl; 
-    // std::cerr << "Shape: " << fields[stop.shape_idx_1]<< std::endl;
-
-    switch(sid){
-      case SID_1:
-        index = stop.shape_idx_1 ; 
-        break;
-      case SID_2:
-        index = stop.shape_idx_2 ; 
-        break;
-      default:
-        std::cerr << "wrong sid : " << sid << endl;
-        return false;
-    }
-
-    if (fields[index].size() < 4) // this number 4 is really arbitrary
-      continue ; // empty spatial object 
-
-    try { 
-      poly = wkt_reader->read(fields[index]);
-    }
-    catch (...) {
-      std::cerr << "******Geometry Parsing Error******" << std::endl;
-      return -1;
-    }
-    if (previd.compare(tile_id) !=0 && previd.size() > 0 ) {
-      int  pairs = joinBucket();
-      std::cerr <<"T[" << previd << "] |" << polydata[SID_1].size() << "|x|" << polydata[SID_2].size() << "|=|" << pairs << "|" <<std::endl;
+  while (readRecord(cin, tile_id, input_line)) {
+    if (!binary_input && input_line.empty())
+      continue;
+
+    if (bucket.tile_id.compare(tile_id) !=0 && bucket.tile_id.size() > 0 ) {
+      int  pairs = joinTile(bucket, spill, out);
+      // a geometry of the tile could not be parsed (or refined)
+      if (pairs < 0)
+        return -1;
+      start = std::chrono::steady_clock::now();
+      out.write(cout);
+      out.clear();
+      bucket.prof.output_time += secondsSince(start);
+      reportTile(bucket, pairs, std::cerr);
+      if (profiling)
+        profileTile(bucket, pairs, profile_file);
       tile_counter++; 
-      releaseShapeMem(stop.join_cardinality);
+      releaseShapeMem(bucket, stop.join_cardinality);
     }
 
-    // populate the bucket for join 
-    polydata[sid].push_back(poly);
-    // rawdata[sid].push_back(project(fields,sid));
-    switch(sid){
-      case SID_1:
-        rawdata[sid].push_back(project(fields,SID_1));
-        break;
-      case SID_2:
-        rawdata[sid].push_back(project(fields,SID_2));
-        break;
-      default:
-        std::cerr << "wrong sid : " << sid << endl;
-        return false;
-    }
-    previd = tile_id; 
-
-    fields.clear();
+    if (profiling)
+      start = std::chrono::steady_clock::now();
+    bucket.tile_id = tile_id;
+    if (loadInput(bucket, input_line, fields) < 0)
+      return -1;
+    if (mem_limit > 0 && bucket.bytes > mem_limit && !spillBucket(bucket, spill))
+      return -1;
+    if (profiling)
+      bucket.prof.parse_time += secondsSince(start);
   }
   // last tile
-  int  pairs = joinBucket();
-  std::cerr <<"T[" << previd << "] |" << polydata[SID_1].size() << "|x|" << polydata[SID_2].size() << "|=|" << pairs << "|" <<std::endl;
+  int  pairs = joinTile(bucket, spill, out);
+  if (pairs < 0)
+    return -1;
+  start = std::chrono::steady_clock::now();
+  out.write(cout);
+  bucket.prof.output_time += secondsSince(start);
+  reportTile(bucket, pairs, std::cerr);
+  if (profiling)
+    profileTile(bucket, pairs, profile_file);
   tile_counter++;
-  releaseShapeMem(stop.join_cardinality);
+  releaseShapeMem(bucket, stop.join_cardinality);
   
   // clean up newed objects
-  delete wkt_reader ;
   delete gf ;
   delete pm ;
 
   return tile_counter;
 }
 
-void releaseShapeMem(const int k ){
+/* Writes finished tiles to stdout, either in input order or as they
+ * complete. Each tile is written as a whole so lines never interleave. */
+class ResultCommitter
+{
+  public:
+    ResultCommitter(bool ordered, long window) : ordered(ordered), window(window), next_seq(0), failures(0) {}
+
+    ~ResultCommitter()
+    {
+      for (size_t k = 0; k < spare.size(); k++)
+        delete spare[k];
+    }
+
+    // written batches are recycled, keeping their arena and buffers
+    tile_batch * acquire()
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (spare.empty())
+        return new tile_batch();
+      tile_batch * batch = spare.back();
+      spare.pop_back();
+      return batch;
+    }
+
+    bool failed()
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      return failures > 0;
+    }
+
+    // block the reader while too many tiles wait for an earlier one
+    void waitForSlot(long seq)
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      slot_free.wait(lock, [this, seq] { return !ordered || seq - next_seq < window; });
+    }
+
+    void commit(tile_batch * batch)
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!ordered) {
+        write(batch);
+        return;
+      }
+      pending[batch->seq] = batch;
+      map<long, tile_batch*>::iterator it;
+      while ((it = pending.find(next_seq)) != pending.end()) {
+        write(it->second);
+        pending.erase(it);
+        next_seq++;
+      }
+      slot_free.notify_all();
+    }
+
+  private:
+    void write(tile_batch * batch)
+    {
+      if (batch->failed)
+        failures++;
+      batch->result.write(cout);
+      std::cerr << batch->info;
+      if (profiling)
+        profile_file << batch->profile;
+      batch->result.clear();
+      batch->info.clear();
+      batch->profile.clear();
+      spare.push_back(batch);
+    }
+
+    bool ordered;
+    long window;
+    long next_seq;
+    long failures;
+    map<long, tile_batch*> pending;
+    vector<tile_batch*> spare;
+    std::mutex mtx;
+    std::condition_variable slot_free;
+};
+
+/* Parser stage: splits the records of a whole tile and scans their MBRs */
+void parseWorker(BoundedQueue<tile_batch*> * in, BoundedQueue<tile_batch*> * out)
+{
+  vector<field_t> fields;
+  tile_batch * batch = NULL;
+
+  while (in->pop(batch)) {
+    batch->pm = new PrecisionModel();
+    batch->gf = new GeometryFactory(batch->pm,OSM_SRID);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t k = 0; k < batch->lines.size() && !batch->failed; k++) {
+      batch->failed = loadInput(batch->bucket, batch->lines[k], fields) < 0;
+    }
+    batch->lines.clear();
+    batch->bucket.prof.parse_time += secondsSince(start);
+    out->push(batch);
+  }
+}
+
+/* Join stage: builds the index and refines parsed tiles */
+void joinWorker(BoundedQueue<tile_batch*> * in, ResultCommitter * committer)
+{
+  tile_batch * batch = NULL;
+
+  while (in->pop(batch)) {
+    tile_bucket & bucket = batch->bucket;
+    bucket.factory = batch->gf;
+    if (!batch->failed) {
+      std::stringstream info;
+      int pairs = joinBucket(bucket, batch->result);
+      // a geometry parsed lazily in the join could not be read: the
+      // committer stops the run, without the partial output of the tile
+      if (pairs < 0) {
+        batch->failed = true;
+        batch->result.clear();
+      }
+      reportTile(bucket, pairs, info);
+      batch->info = info.str();
+      if (profiling) {
+        std::stringstream record;
+        profileTile(bucket, pairs, record);
+        batch->profile = record.str();
+      }
+    }
+    releaseShapeMem(bucket, stop.join_cardinality);
+    delete batch->gf;
+    delete batch->pm;
+    committer->commit(batch);
+  }
+}
+
+/* Pipelined engine: the main thread reads stdin and cuts it into tiles,
+ * parser threads turn WKT into geometries and join threads build the
+ * index and refine. The stages are connected by bounded queues, so the
+ * parsing of the next tiles overlaps with the refinement of the current. */
+int mJoinQueryThreaded()
+{
+  string input_line;
+  string tile_id;
+  tile_batch * batch = NULL;
+  long seq = 0;
+
+  BoundedQueue<tile_batch*> parse_queue(2 * num_parsers);
+  BoundedQueue<tile_batch*> join_queue(2 * num_threads);
+  ResultCommitter committer(ordered_output, 2 * (num_threads + num_parsers) + 2);
+  std::vector<std::thread> parsers;
+  std::vector<std::thread> joiners;
+  for (int t = 0; t < num_parsers; t++)
+    parsers.push_back(std::thread(parseWorker, &parse_queue, &join_queue));
+  for (int t = 0; t < num_threads; t++)
+    joiners.push_back(std::thread(joinWorker, &join_queue, &committer));
+
+  std::cerr << "Bucketinfo:[ID] |A|x|B|=|R|" <<std::endl;
+  while (readRecord(cin, tile_id, input_line)) {
+    if (!binary_input && input_line.empty())
+      continue;
+    if (batch != NULL && batch->bucket.tile_id.compare(tile_id) != 0) {
+      committer.waitForSlot(batch->seq);
+      parse_queue.push(batch);
+      batch = NULL;
+      if (committer.failed())
+        break;
+    }
+    if (batch == NULL) {
+      batch = committer.acquire();
+      batch->seq = seq++;
+      batch->bucket.tile_id = tile_id;
+      batch->failed = false;
+    }
+    batch->lines.push_back(input_line);
+  }
+  // last tile
+  if (batch != NULL) {
+    committer.waitForSlot(batch->seq);
+    parse_queue.push(batch);
+  }
+
+  // drain the pipeline stage by stage
+  parse_queue.close();
+  for (size_t t = 0; t < parsers.size(); t++)
+    parsers[t].join();
+  join_queue.close();
+  for (size_t t = 0; t < joiners.size(); t++)
+    joiners[t].join();
+
+  return committer.failed() ? -1 : seq;
+}
+
+// drops the objects of one set of the bucket with their geometries
+void releaseSet(tile_bucket & b, int sid)
+{
+  std::vector<tile_object> & objects = b.polydata[sid];
+  for (size_t i = 0; i < objects.size(); i++)
+    delete objects[i].geom;
+  objects.clear();
+  b.rawdata[sid].clear();
+}
+
+void releaseShapeMem(tile_bucket & b, const int k ){
   if (k <=0)
     return ;
   for (int j =0 ; j <k ;j++ )
-  {
-    int delete_index = j+1 ;
-    int len = polydata[delete_index].size();
-
-    for (int i = 0; i < len ; i++) 
-      delete polydata[delete_index][i];
-    
-    polydata[delete_index].clear();
-    rawdata[delete_index].clear();
-  }
+    releaseSet(b, j+1);
+  b.arena.reset();
+  b.prof = tile_profile();
+  b.bytes = 0;
+  b.spilled[SID_1] = b.spilled[SID_2] = 0;
 }
 
-bool buildIndex(map<int,Geometry*> & geom_polygons) {
+/* Feeds the MBRs of the objects of a tile to the R-tree bulk loader */
+class ObjectDataStream : public IDataStream
+{
+  public:
+    ObjectDataStream(std::vector<tile_object> & objects) : objects(objects), next(0) {}
+
+    virtual IData* getNext()
+    {
+      if (next >= objects.size())
+        return 0;
+      const Envelope & env = objects[next].env;
+      double low[2] = { env.getMinX(), env.getMinY() };
+      double high[2] = { env.getMaxX(), env.getMaxY() };
+      Region r(low, high, 2);
+      return new RTree::Data(0, 0, r, next++);
+    }
+
+    virtual bool hasNext() { return next < objects.size(); }
+
+    virtual uint32_t size() { return objects.size(); }
+
+    virtual void rewind() { next = 0; }
+
+  private:
+    std::vector<tile_object> & objects;
+    size_t next;
+};
+
+bool buildIndex(std::vector<tile_object> & objects, ISpatialIndex * & spidx, IStorageManager * & storage) {
     // build spatial index on tile boundaries 
     id_type  indexIdentifier;
-    GEOSDataStream stream(&geom_polygons);
+    ObjectDataStream stream(objects);
     storage = StorageManager::createNewMemoryStorageManager();
     spidx   = RTree::createAndBulkLoadNewRTree(RTree::BLM_STR, stream, *storage, 
 	    FillFactor,
@@ -176,57 +647,66 @@ bool buildIndex(map<int,Geometry*> & geom_polygons) {
 }
 
 
+/* Prepare the probe geometry once for all of its candidates.
+ * Returns NULL when the predicate has no prepared form or when
+ * the geometry cannot be prepared; callers then fall back to
+ * the plain predicates. */
+const PreparedGeometry * prepareGeometry(const Geometry * geom, const int jp)
+{
+  switch (jp){
+    case ST_INTERSECTS:
+    case ST_TOUCHES:
+    case ST_CROSSES:
+    case ST_CONTAINS:
+    case ST_ADJACENT:
+    case ST_DISJOINT:
+    case ST_WITHIN:
+    case ST_OVERLAPS:
+      try {
+        return PreparedGeometryFactory::prepare(geom);
+      }
+      catch (...) {
+        return NULL;
+      }
+
+    default:
+      return NULL;
+  }
+}
+
 bool join_with_predicate(const Geometry * geom1 , const Geometry * geom2, 
         const Envelope * env1, const Envelope * env2,
-        const int jp){
+        const int jp, const PreparedGeometry * pgeom1 = NULL){
   bool flag = false ; 
 //  const Envelope * env1 = geom1->getEnvelopeInternal();
 //  const Envelope * env2 = geom2->getEnvelopeInternal();
-  BufferOp * buffer_op1 = NULL ;
-  BufferOp * buffer_op2 = NULL ;
-  Geometry* geom_buffer1 = NULL;
-  Geometry* geom_buffer2 = NULL;
-  Geometry* geomUni = NULL;
-  Geometry* geomIntersect = NULL; 
 
   switch (jp){
 
     case ST_INTERSECTS:
-      cerr << "1: " << env1->toString() << " and " << geom1->toString() << endl;
-      cerr << "2: " << env2->toString() << " and " << geom2->toString() << endl;
-   
-      cerr << "touching: " <<  env1->intersects(env2) << endl;
-      flag = env1->intersects(env2) && geom1->intersects(geom2);
-      if (flag && appendstats) {
-             area1 = geom1->getArea();
-             area2 = geom2->getArea();
-             geomUni = geom1->Union(geom2);
-             union_area = geomUni->getArea();
-             geomIntersect = geom1->intersection(geom2);
-             intersect_area = geomIntersect->getArea();
-	     delete geomUni;
-	     delete geomIntersect;
-      }
+      flag = env1->intersects(env2) && 
+          (pgeom1 ? pgeom1->intersects(geom2) : geom1->intersects(geom2));
       break;
 
     case ST_TOUCHES:
-      flag = geom1->touches(geom2);
+      flag = pgeom1 ? pgeom1->touches(geom2) : geom1->touches(geom2);
       break;
 
     case ST_CROSSES:
-      flag = geom1->crosses(geom2);
+      flag = pgeom1 ? pgeom1->crosses(geom2) : geom1->crosses(geom2);
       break;
 
     case ST_CONTAINS:
-      flag = env1->contains(env2) && geom1->contains(geom2);
+      flag = env1->contains(env2) && 
+          (pgeom1 ? pgeom1->contains(geom2) : geom1->contains(geom2));
       break;
 
     case ST_ADJACENT:
-      flag = ! geom1->disjoint(geom2);
+      flag = ! (pgeom1 ? pgeom1->disjoint(geom2) : geom1->disjoint(geom2));
       break;
 
     case ST_DISJOINT:
-      flag = geom1->disjoint(geom2);
+      flag = pgeom1 ? pgeom1->disjoint(geom2) : geom1->disjoint(geom2);
       break;
 
     case ST_EQUALS:
@@ -243,29 +723,18 @@ bool join_with_predicate(const Geometry * geom1 , const Geometry * geom2,
           break;
      }
 
-      buffer_op1 = new BufferOp(geom1);
-      // buffer_op2 = new BufferOp(geom2);
-      if (NULL == buffer_op1)
-        cerr << "NULL: buffer_op1" <<endl;
-
-      geom_buffer1 = buffer_op1->getResultGeometry(stop.expansion_distance);
-      env1 = geom_buffer1->getEnvelopeInternal();
-      // geom_buffer2 = buffer_op2->getResultGeometry(expansion_distance);
-      //Envelope * env_temp = geom_buffer1->getEnvelopeInternal();
-      if (NULL == geom_buffer1)
-        cerr << "NULL: geom_buffer1" <<endl;
-
-      flag = join_with_predicate(geom_buffer1,geom2, env1, env2, ST_INTERSECTS);
-      delete geom_buffer1;
-
+      /* Exact distance test for all other geometries; it stops as soon
+       * as two components are found within the distance */
+      flag = env1->distance(env2) <= stop.expansion_distance &&
+          geom1->isWithinDistance(geom2, stop.expansion_distance);
       break;
 
     case ST_WITHIN:
-      flag = geom1->within(geom2);
+      flag = pgeom1 ? pgeom1->within(geom2) : geom1->within(geom2);
       break; 
 
     case ST_OVERLAPS:
-      flag = geom1->overlaps(geom2);
+      flag = pgeom1 ? pgeom1->overlaps(geom2) : geom1->overlaps(geom2);
       break;
 
     default:
@@ -275,58 +744,46 @@ bool join_with_predicate(const Geometry * geom1 , const Geometry * geom2,
   return flag; 
 }
 
+// the k-th output field of a record, NULL when it does not exist
+inline const field_t * projectedField(vector<field_t> & fields, const vector<int> & proj, size_t k)
+{
+  /* Do not output tileid and joinid */
+  size_t idx = proj.size() == 0 ? k + 2 : proj[k];
+  return idx < fields.size() ? &fields[idx] : NULL;
+}
+
 /* Filter selected fields for output
- * If there is no field selected, output all fields (except tileid and joinid) */
-string project( vector<string> & fields, int sid) {
-  std::stringstream ss;
-  switch (sid){
-    case 1:
-      if (stop.proj1.size() == 0) {
-          /* Do not output tileid and joinid */
-	  ss << fields[2];
-          for (int i = 3 ; i < fields.size(); i++)
-          {
-             ss << TAB << fields[i];
-          }
-      } else {
-          for (int i = 0 ; i <stop.proj1.size();i++)
-          {
-             if ( 0 == i )
-               ss << fields[stop.proj1[i]] ;
-             else
-             {
-                if (stop.proj1[i] < fields.size())
-                ss << TAB << fields[stop.proj1[i]];
-             }
-          }
-      }
-      break;
-    case 2:
-       if (stop.proj2.size() == 0) {
-          /* Do not output tileid and joinid */
-	  ss << fields[2];
-          for (int i = 3 ; i < fields.size(); i++)
-          {
-             ss << TAB << fields[i];
-          }
-      } else {
-          for (int i = 0 ; i <stop.proj2.size();i++)
-          {
-             if ( 0 == i )
-               ss << fields[stop.proj2[i]] ;
-             else
-             {
-                if (stop.proj2[i] < fields.size())
-                ss << TAB << fields[stop.proj2[i]];
-             }
-          }
-      }
-      break;
-    default:
-      break;
+ * If there is no field selected, output all fields (except tileid and joinid)
+ * The row is written into the tile arena, sized in a first pass over the fields. */
+const char * project( vector<field_t> & fields, int sid, TileArena & arena) {
+  // the counting outputs and the semi and anti joins only name objects of set 1
+  if (output_mode == OUTPUT_COUNT || ((output_mode == OUTPUT_COUNT_LEFT || join_mode != JOIN_PAIRS) && sid != SID_1))
+    return "";
+  const vector<int> & proj = sid == SID_1 ? stop.proj1 : stop.proj2;
+  size_t count = proj.size() == 0 ? (fields.size() > 2 ? fields.size() - 2 : 0) : proj.size();
+  if ((output_mode == OUTPUT_IDS || output_mode == OUTPUT_COUNT_LEFT) && count > 1)
+    count = 1;
+  const field_t * field = NULL;
+
+  size_t len = 0;
+  for (size_t k = 0; k < count; k++)
+    if ((field = projectedField(fields, proj, k)) != NULL)
+      len += field->len + TAB.size();
+
+  char * row = static_cast<char*>(arena.allocate(len + 1));
+  char * pos = row;
+  for (size_t k = 0; k < count; k++) {
+    if ((field = projectedField(fields, proj, k)) == NULL)
+      continue;
+    if (pos != row || k > 0) {
+      memcpy(pos, TAB.data(), TAB.size());
+      pos += TAB.size();
+    }
+    memcpy(pos, field->ptr, field->len);
+    pos += field->len;
   }
-
-  return ss.str();
+  *pos = '\0';
+  return row;
 }
 
 /* Set output fields
@@ -396,107 +853,817 @@ int getJoinPredicate(char * predicate_str)
 }
 
 /* Report result separated by sep */
-void ReportResult( int i , int j)
+void ReportResult(tile_bucket & b, const char * row1, const char * row2, ResultBuffer & out)
 {
   switch (stop.join_cardinality){
     case 1:
-      cout << rawdata[SID_1][i] << SEP << rawdata[SID_1][j] << endl;
+      out.append(row1).append(SEP).append(row2).endRow();
       break;
     case 2:
-      cout << rawdata[SID_1][i] << SEP << rawdata[SID_2][j]; 
+      out.append(row1).append(SEP).append(row2);
       if (appendstats) {
-          cout << SEP << area1 << TAB << area2 << TAB << union_area 
-              << TAB << intersect_area << TAB << intersect_area / union_area;
+          out.append(SEP).append(area1).append(TAB).append(area2).append(TAB).append(union_area)
+              .append(TAB).append(intersect_area).append(TAB).append(intersect_area / union_area);
       }
       if (appendTileID) {
-          cout << TAB << previd << endl; 
+          out.append(TAB).append(b.tile_id);
       }
-      cout << endl;
+      out.endRow();
       break;
     default:
       return ;
   }
 }
 
-int joinBucket() 
+/* Per tile information line: |A|x|B|=|R| and the filter timing */
+void reportTile(tile_bucket & b, int pairs, ostream & info)
+{
+  info <<"T[" << b.tile_id << "] |" << b.polydata[SID_1].size() + b.spilled[SID_1] << "|x|"
+      << b.polydata[SID_2].size() + b.spilled[SID_2] << "|=|" << pairs << "|";
+  if (b.filter > 0)
+    info << " " << (b.filter == FILTER_SWEEP ? "sweep" : "rtree") << " "
+        << (b.prof.index_time + b.prof.filter_time) * 1000 << "ms";
+  info << std::endl;
+}
+
+/* Per tile profile record, one JSON object per line. Times are in
+ * milliseconds; peak_rss_kb is the peak resident size of the process
+ * so far. */
+void profileTile(tile_bucket & b, int pairs, ostream & os)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  os << "{\"tile\":\"";
+  for (size_t k = 0; k < b.tile_id.size(); k++) {
+    if (b.tile_id[k] == '"' || b.tile_id[k] == '\\')
+      os << '\\';
+    os << b.tile_id[k];
+  }
+  os << "\",\"objects1\":" << b.polydata[SID_1].size() + b.spilled[SID_1]
+     << ",\"objects2\":" << b.polydata[SID_2].size() + b.spilled[SID_2]
+     << ",\"filter\":\"" << (b.filter == FILTER_SWEEP ? "sweep" : b.filter == FILTER_RTREE ? "rtree" : "none")
+     << "\",\"parse_ms\":" << b.prof.parse_time * 1000
+     << ",\"index_ms\":" << b.prof.index_time * 1000
+     << ",\"filter_ms\":" << b.prof.filter_time * 1000
+     << ",\"refine_ms\":" << b.prof.refine_time * 1000
+     << ",\"output_ms\":" << b.prof.output_time * 1000
+     << ",\"candidates\":" << b.prof.candidates
+     << ",\"results\":" << pairs
+     << ",\"peak_rss_kb\":" << usage.ru_maxrss << "}" << std::endl;
+}
+
+sweep_entry * loadSweepEntries(std::vector<tile_object> & poly_set, double expansion, TileArena & arena)
+{
+  sweep_entry * entries = arena.allocate<sweep_entry>(poly_set.size());
+  for (size_t k = 0; k < poly_set.size(); k++) {
+    const Envelope * env = &poly_set[k].env;
+    entries[k].min_x = env->getMinX() - expansion;
+    entries[k].min_y = env->getMinY() - expansion;
+    entries[k].max_x = env->getMaxX() + expansion;
+    entries[k].max_y = env->getMaxY() + expansion;
+    entries[k].id = k;
+  }
+  std::sort(entries, entries + poly_set.size());
+  return entries;
+}
+
+/* Plane sweep filter: both sets are sorted by min x and swept once,
+ * reporting every pair with intersecting MBRs. The candidate pairs
+ * (probe from set one, candidate from set two) come back sorted by
+ * probe so they can be refined the same way as R-tree hits. */
+void sweepFilter(const sweep_entry * set1, size_t len1, const sweep_entry * set2, size_t len2,
+    candidate_list & candidates)
+{
+  size_t i = 0, j = 0;
+  while (i < len1 && j < len2) {
+    if (set1[i].min_x <= set2[j].min_x) {
+      const sweep_entry & e = set1[i++];
+      for (size_t k = j; k < len2 && set2[k].min_x <= e.max_x; k++)
+        if (set2[k].min_y <= e.max_y && set2[k].max_y >= e.min_y)
+          candidates.push_back(pair<int,int>(e.id, set2[k].id));
+    } else {
+      const sweep_entry & e = set2[j++];
+      for (size_t k = i; k < len1 && set1[k].min_x <= e.max_x; k++)
+        if (set1[k].min_y <= e.max_y && set1[k].max_y >= e.min_y)
+          candidates.push_back(pair<int,int>(set1[k].id, e.id));
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+}
+
+/* Refinement state of one thread working on a tile: its geometry readers,
+ * its share of the stage timings, its output and its result count */
+struct refine_worker {
+  WKTReader * wkt_reader;
+  WKBReader * wkb_reader;
+  tile_profile prof;
+  ResultBuffer * out;
+  int pairs;
+  // --output count-per-left: matches of each object of set 1, and of set 2
+  // for the pairs reported in the reverse orientation (--symmetric both)
+  vector<long> counts1;
+  vector<long> counts2;
+};
+
+/* How the pairs of a tile are selected, shared by the refinement threads */
+struct join_setup {
+  int idx1;
+  int idx2;
+  bool selfjoin;
+  bool symmetric;   // refine (i, j) only for i < j
+  bool dedup;       // report only the pairs owned by the tile
+  long tile_no;
+  long base1;       // position of the first object of each set in the
+  long base2;       // self-joined set, when the sets are blocks of it
+};
+
+// pairs of a self-join that are not refined: an object with itself, and
+// (j, i) for a symmetric predicate, which is refined as (i, j)
+inline bool skipSelfPair(const join_setup & js, int i, int j)
+{
+  long pos1 = js.base1 + i;
+  long pos2 = js.base2 + j;
+  return js.selfjoin && (pos2 == pos1 || (js.symmetric && pos2 < pos1));
+}
+
+// the geometry of an object, parsed from its WKT (WKB) on first use
+const Geometry * objectGeometry(refine_worker & w, tile_object & obj)
+{
+  if (obj.geom == NULL) {
+    std::chrono::steady_clock::time_point start;
+    if (profiling)
+      start = std::chrono::steady_clock::now();
+    try {
+      if (binary_input) {
+        std::istringstream wkb(string(obj.shape, obj.shape_len));
+        obj.geom = w.wkb_reader->read(wkb);
+      }
+      else
+        obj.geom = w.wkt_reader->read(string(obj.shape, obj.shape_len));
+    }
+    catch (...) {
+      std::cerr << "******Geometry Parsing Error******" << std::endl;
+      throw;
+    }
+    if (profiling)
+      w.prof.parse_time += secondsSince(start);
+  }
+  return obj.geom;
+}
+
+// the area of an object, computed once per tile
+double objectArea(refine_worker & w, tile_object & obj)
+{
+  if (obj.area < 0)
+    obj.area = objectGeometry(w, obj)->getArea();
+  return obj.area;
+}
+
+/* Overlap statistics of an intersecting pair, with at most one overlay:
+ * when one object covers the other the intersection is the covered
+ * object, and the union area is derived from the intersection area. */
+void overlapStats(refine_worker & w, tile_object & obj1, tile_object & obj2,
+    const PreparedGeometry * pgeom1)
+{
+  area1 = objectArea(w, obj1);
+  area2 = objectArea(w, obj2);
+  if (obj1.env.covers(&obj2.env) &&
+      (pgeom1 ? pgeom1->covers(obj2.geom) : obj1.geom->covers(obj2.geom))) {
+    intersect_area = area2;
+  }
+  else if (obj2.env.covers(&obj1.env) && obj2.geom->covers(obj1.geom)) {
+    intersect_area = area1;
+  }
+  else {
+    Geometry * geomIntersect = obj1.geom->intersection(obj2.geom);
+    intersect_area = geomIntersect->getArea();
+    delete geomIntersect;
+  }
+  union_area = area1 + area2 - intersect_area;
+}
+
+// predicates where (a, b) holds exactly when (b, a) holds
+bool symmetricPredicate(const int jp)
+{
+  switch (jp){
+    case ST_INTERSECTS:
+    case ST_TOUCHES:
+    case ST_CROSSES:
+    case ST_ADJACENT:
+    case ST_DISJOINT:
+    case ST_EQUALS:
+    case ST_DWITHIN:
+    case ST_OVERLAPS:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void addProfile(tile_profile & to, const tile_profile & from)
+{
+  to.parse_time += from.parse_time;
+  to.index_time += from.index_time;
+  to.filter_time += from.filter_time;
+  to.refine_time += from.refine_time;
+  to.output_time += from.output_time;
+  to.candidates += from.candidates;
+}
+
+/* R-tree filter of one probe: the ids of set two objects whose MBR
+ * intersects the (expanded for st_dwithin) MBR of the probe */
+void queryProbe(tile_bucket & b, ISpatialIndex * spidx, const Envelope * env1, vector<id_type> & hits)
+{
+  double low[2], high[2];
+  low[0] = env1->getMinX();
+  low[1] = env1->getMinY();
+  high[0] = env1->getMaxX();
+  high[1] = env1->getMaxY();
+  /* Handle the buffer expansion for R-tree */
+  if (stop.JOIN_PREDICATE == ST_DWITHIN) {
+    low[0] -= stop.expansion_distance;
+    low[1] -= stop.expansion_distance;
+    high[0] += stop.expansion_distance;
+    high[1] += stop.expansion_distance;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Region r(low, high, 2);
+  MyVisitor vis(hits);
+  spidx->intersectsWithQuery(r, vis);
+  b.prof.filter_time += secondsSince(start);
+}
+
+/* Refines probe i of set one against its candidates from set two */
+void refineProbe(tile_bucket & b, refine_worker & w, const join_setup & js,
+    int i, const vector<id_type> & hits)
+{
+  std::vector<tile_object> & poly_set_one = b.polydata[js.idx1];
+  std::vector<tile_object> & poly_set_two = b.polydata[js.idx2];
+  const Envelope * env1 = &poly_set_one[i].env;
+  const Geometry * geom1 = NULL;
+  const PreparedGeometry * pgeom1 = NULL;
+  double parse_before = w.prof.parse_time;
+  double output_before = w.prof.output_time;
+  std::chrono::steady_clock::time_point start, probe_start;
+  if (profiling)
+    probe_start = std::chrono::steady_clock::now();
+
+  try {
+    for (uint32_t j = 0 ; j < hits.size(); j++ ) 
+    {
+      if (skipSelfPair(js, i, hits[j])) {
+        continue;
+      }
+      const Envelope * env2 = &poly_set_two[hits[j]].env;
+      if (js.dedup && partitions.owner(env1, env2) != js.tile_no) {
+        continue;
+      }
+      // the probe is refined against all its candidates, prepare it once
+      if (geom1 == NULL) {
+        geom1 = objectGeometry(w, poly_set_one[i]);
+        pgeom1 = prepareGeometry(geom1, stop.JOIN_PREDICATE);
+      }
+      const Geometry* geom2 = objectGeometry(w, poly_set_two[hits[j]]);
+      if (join_with_predicate(geom1, geom2, env1, env2,
+            stop.JOIN_PREDICATE, pgeom1))  {
+        if (join_mode != JOIN_PAIRS) {
+          // the first match decides, the other candidates are not refined
+          w.counts1[i] = 1;
+          break;
+        }
+        bool both = js.symmetric && symmetric_mode == SYMMETRIC_BOTH;
+        if (output_mode == OUTPUT_COUNT || output_mode == OUTPUT_COUNT_LEFT) {
+          w.pairs += both ? 2 : 1;
+          if (output_mode == OUTPUT_COUNT_LEFT) {
+            w.counts1[i]++;
+            if (both)
+              w.counts2[hits[j]]++;
+          }
+          continue;
+        }
+        if (appendstats && stop.JOIN_PREDICATE == ST_INTERSECTS)
+          overlapStats(w, poly_set_one[i], poly_set_two[hits[j]], pgeom1);
+        if (profiling)
+          start = std::chrono::steady_clock::now();
+        ReportResult(b, b.rawdata[js.idx1][i], b.rawdata[js.idx2][hits[j]], *w.out);
+        w.pairs++;
+        if (both) {
+          ReportResult(b, b.rawdata[js.idx2][hits[j]], b.rawdata[js.idx1][i], *w.out);
+          w.pairs++;
+        }
+        if (profiling)
+          w.prof.output_time += secondsSince(start);
+      }
+    }
+  }
+  catch (...) {
+    if (pgeom1 != NULL)
+      PreparedGeometryFactory::destroy(pgeom1);
+    throw;
+  }
+  if (pgeom1 != NULL)
+    PreparedGeometryFactory::destroy(pgeom1);
+
+  // what is left of the probe time is spent in the exact predicates
+  if (profiling)
+    w.prof.refine_time += secondsSince(probe_start) - (w.prof.parse_time - parse_before)
+        - (w.prof.output_time - output_before);
+}
+
+// sizes the match counters of a worker for --output count-per-left and
+// the semi and anti joins
+void resetCounts(refine_worker & w, const join_setup & js, size_t len1, size_t len2)
+{
+  if (output_mode != OUTPUT_COUNT_LEFT && join_mode == JOIN_PAIRS)
+    return;
+  w.counts1.assign(len1, 0);
+  if (js.symmetric && symmetric_mode == SYMMETRIC_BOTH)
+    w.counts2.assign(len2, 0);
+  else
+    w.counts2.clear();
+}
+
+void addCounts(vector<long> & to, const vector<long> & from)
+{
+  for (size_t k = 0; k < from.size(); k++)
+    to[k] += from[k];
+}
+
+/* --output count-per-left: one line per object with matches, its output
+ * row (the first selected field) and the number of matches. Lines with
+ * the same object from other tiles or blocks add up. */
+void reportCounts(tile_bucket & b, const join_setup & js, refine_worker & w, ResultBuffer & out)
+{
+  if (js.idx1 == js.idx2 && !w.counts2.empty()) {
+    addCounts(w.counts1, w.counts2);
+    w.counts2.clear();
+  }
+  for (size_t k = 0; k < w.counts1.size(); k++)
+    if (w.counts1[k] > 0)
+      out.append(b.rawdata[js.idx1][k]).append(TAB).append(w.counts1[k]).endRow();
+  for (size_t k = 0; k < w.counts2.size(); k++)
+    if (w.counts2[k] > 0)
+      out.append(b.rawdata[js.idx2][k]).append(TAB).append(w.counts2[k]).endRow();
+}
+
+/* --mode semi: the output rows of the objects of set 1 with a match.
+ * --mode anti: the output rows of all objects of set 1, each followed by
+ * 1 when it has a match in this tile and 0 otherwise. An object copied to
+ * several tiles (or blocks) has no match when all its rows end with 0,
+ * hgdeduplicater.py anti keeps those. Returns the number of objects with
+ * a match (semi) or without one (anti). */
+int reportObjects(tile_bucket & b, const join_setup & js, refine_worker & w, ResultBuffer & out)
+{
+  int count = 0;
+  for (size_t k = 0; k < w.counts1.size(); k++) {
+    bool matched = w.counts1[k] > 0;
+    if (join_mode == JOIN_SEMI && matched) {
+      out.append(b.rawdata[js.idx1][k]).endRow();
+      count++;
+    }
+    else if (join_mode == JOIN_ANTI) {
+      out.append(b.rawdata[js.idx1][k]).append(TAB).append(matched ? '1' : '0').endRow();
+      if (!matched)
+        count++;
+    }
+  }
+  return count;
+}
+
+/* Computes the cached envelopes of a geometry and of all its components,
+ * which GEOS otherwise fills in lazily on first use. Geometries shared
+ * by refinement threads are then only read. */
+class EnvelopeFilter : public GeometryComponentFilter
+{
+  public:
+    void filter_ro(const Geometry * g) { g->getEnvelopeInternal(); }
+};
+
+/* A large tile refined by several threads */
+struct split_job {
+  tile_bucket * b;
+  join_setup js;
+  candidate_list * candidates;
+  vector<int> shared;          // objects parsed before the refinement
+  vector<size_t> chunks;       // first candidate of each chunk, and the end
+  vector<ResultBuffer> outs;   // output of each chunk
+  vector<refine_worker> workers;
+  std::atomic<size_t> next_chunk;
+  std::atomic<bool> failed;
+};
+
+// parses the shared objects with index t, t + threads, ...
+void splitParseWorker(split_job * job, int t)
+{
+  std::vector<tile_object> & poly_set_two = job->b->polydata[job->js.idx2];
+  refine_worker & w = job->workers[t];
+  WKTReader wkt_reader(job->b->factory);
+  WKBReader wkb_reader(*job->b->factory);
+  EnvelopeFilter envelopes;
+
+  w.wkt_reader = &wkt_reader;
+  w.wkb_reader = &wkb_reader;
+  try {
+    for (size_t k = t; k < job->shared.size(); k += job->workers.size()) {
+      tile_object & obj = poly_set_two[job->shared[k]];
+      objectGeometry(w, obj)->apply_ro(&envelopes);
+      if (appendstats)
+        objectArea(w, obj);
+    }
+  }
+  catch (...) {
+    job->failed = true;
+  }
+  w.wkt_reader = NULL;
+  w.wkb_reader = NULL;
+}
+
+// refines the chunks it takes from the job until none is left
+void splitRefineWorker(split_job * job, int t)
+{
+  candidate_list & candidates = *job->candidates;
+  refine_worker & w = job->workers[t];
+  WKTReader wkt_reader(job->b->factory);
+  WKBReader wkb_reader(*job->b->factory);
+  vector<id_type> hits;
+  size_t c;
+
+  w.wkt_reader = &wkt_reader;
+  w.wkb_reader = &wkb_reader;
+  while (!job->failed && (c = job->next_chunk++) + 1 < job->chunks.size()) {
+    w.out = &job->outs[c];
+    try {
+      size_t k = job->chunks[c];
+      while (k < job->chunks[c + 1]) {
+        int i = candidates[k].first;
+        hits.clear();
+        while (k < job->chunks[c + 1] && candidates[k].first == i)
+          hits.push_back(candidates[k++].second);
+        refineProbe(*job->b, w, job->js, i, hits);
+      }
+    }
+    catch (...) {
+      job->failed = true;
+    }
+  }
+  w.wkt_reader = NULL;
+  w.wkb_reader = NULL;
+}
+
+/* Refinement of a large tile by tile_threads threads. The candidate pairs
+ * the tile does not report are dropped first, and every object of set two
+ * left in a pair (of both sets for a self-join) is parsed up front, so
+ * that the threads never modify an object they share. The probes are then
+ * cut into chunks of similar candidate counts, refined in parallel and
+ * written in probe order: the output is the same as the sequential one.
+ * The match counters of the threads are added to those of w.
+ * Returns the number of results, -1 on error. */
+int refineSplit(tile_bucket & b, const join_setup & js, candidate_list & candidates, refine_worker & w)
+{
+  std::vector<tile_object> & poly_set_one = b.polydata[js.idx1];
+  std::vector<tile_object> & poly_set_two = b.polydata[js.idx2];
+  split_job job;
+  std::vector<std::thread> threads;
+  size_t live = 0;
+  int pairs = 0;
+
+  for (size_t k = 0; k < candidates.size(); k++) {
+    int i = candidates[k].first;
+    int j = candidates[k].second;
+    if (skipSelfPair(js, i, j))
+      continue;
+    if (js.dedup && partitions.owner(&poly_set_one[i].env, &poly_set_two[j].env) != js.tile_no)
+      continue;
+    candidates[live++] = candidates[k];
+  }
+  candidates.resize(live);
+
+  vector<char> shared(poly_set_two.size(), 0);
+  for (size_t k = 0; k < live; k++) {
+    shared[candidates[k].second] = 1;
+    if (js.idx1 == js.idx2)
+      shared[candidates[k].first] = 1;
+  }
+  for (size_t j = 0; j < shared.size(); j++)
+    if (shared[j] && poly_set_two[j].geom == NULL)
+      job.shared.push_back(j);
+
+  // a few chunks per thread, so that threads finishing early take more
+  size_t chunk_size = live / (4 * tile_threads) + 1;
+  job.chunks.push_back(0);
+  for (size_t k = chunk_size; k < live; k += chunk_size) {
+    while (k < live && candidates[k].first == candidates[k - 1].first)
+      k++;
+    if (k < live)
+      job.chunks.push_back(k);
+  }
+  job.chunks.push_back(live);
+
+  job.b = &b;
+  job.js = js;
+  job.js.dedup = false;   // already applied
+  job.candidates = &candidates;
+  job.outs.resize(job.chunks.size() - 1, ResultBuffer(64 << 10));
+  job.workers.resize(tile_threads);
+  for (size_t t = 0; t < job.workers.size(); t++) {
+    job.workers[t].prof = tile_profile();
+    job.workers[t].pairs = 0;
+    resetCounts(job.workers[t], js, poly_set_one.size(), poly_set_two.size());
+  }
+  job.next_chunk = 0;
+  job.failed = false;
+
+  for (int t = 0; t < tile_threads; t++)
+    threads.push_back(std::thread(splitParseWorker, &job, t));
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+  threads.clear();
+
+  if (!job.failed) {
+    for (int t = 0; t < tile_threads; t++)
+      threads.push_back(std::thread(splitRefineWorker, &job, t));
+    for (size_t t = 0; t < threads.size(); t++)
+      threads[t].join();
+  }
+
+  for (size_t t = 0; t < job.workers.size(); t++) {
+    addProfile(b.prof, job.workers[t].prof);
+    pairs += job.workers[t].pairs;
+    addCounts(w.counts1, job.workers[t].counts1);
+    addCounts(w.counts2, job.workers[t].counts2);
+  }
+  if (job.failed)
+    return -1;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t c = 0; c < job.outs.size(); c++) {
+    w.out->append(job.outs[c]);
+    w.out->flushIfFull();
+  }
+  b.prof.output_time += secondsSince(start);
+  return pairs;
+}
+
+int joinBucket(tile_bucket & b, ResultBuffer & out) 
 {
   // cerr << "---------------------------------------------------" << endl;
   int pairs = 0;
-  bool selfjoin = stop.join_cardinality ==1 ? true : false ;
-  int idx1 = SID_1 ; 
-  int idx2 = selfjoin ? SID_1 : SID_2 ;
-  double low[2], high[2];
+  join_setup js;
+  js.selfjoin = stop.join_cardinality ==1 ? true : false ;
+  // a symmetric self-join refines only the pairs (i, j) with i < j, not
+  // with the early exit of the semi and anti joins
+  js.symmetric = js.selfjoin && symmetric_mode != SYMMETRIC_OFF
+      && symmetricPredicate(stop.JOIN_PREDICATE) && join_mode == JOIN_PAIRS;
+  js.idx1 = SID_1 ; 
+  // the blocks of a spilled self-join are joined like two sets
+  js.idx2 = js.selfjoin && !b.block ? SID_1 : SID_2 ;
+  js.base1 = b.block ? b.base1 : 0;
+  js.base2 = b.block ? b.base2 : 0;
+  // a pair copied to several tiles is only reported by its owner tile
+  js.tile_no = strtol(b.tile_id.c_str(), NULL, 10);
+  js.dedup = !partitions.empty() && partitions.find(js.tile_no) != NULL;
+  ISpatialIndex * spidx = NULL;
+  IStorageManager * storage = NULL;
+  vector<id_type> hits;
+  candidate_list candidates;
+  size_t next_candidate = 0;
+  std::chrono::steady_clock::time_point start;
+  WKTReader wkt_reader(b.factory);
+  WKBReader wkb_reader(*b.factory);
+  refine_worker w;
+
+  w.wkt_reader = &wkt_reader;
+  w.wkb_reader = &wkb_reader;
+  w.prof = tile_profile();
+  w.out = &out;
+  w.pairs = 0;
+  b.filter = 0;
   
   // for each tile (key) in the input stream 
   try { 
 
-    std::vector<Geometry*>  & poly_set_one = polydata[idx1];
-    std::vector<Geometry*>  & poly_set_two = polydata[idx2];
+    std::vector<tile_object>  & poly_set_one = b.polydata[js.idx1];
+    std::vector<tile_object>  & poly_set_two = b.polydata[js.idx2];
 
     int len1 = poly_set_one.size();
     int len2 = poly_set_two.size();
 
     if (len1 <= 0 || len2 <= 0) {
+         // without a second set, every object of the first has no match
+         if (len1 > 0 && join_mode == JOIN_ANTI) {
+             resetCounts(w, js, len1, len2);
+             return reportObjects(b, js, w, out);
+         }
          return 0;
     }
-    
-    map<int,Geometry*> geom_polygons2;
-    for (int j = 0; j < len2; j++) {
-        geom_polygons2[j] = poly_set_two[j];
-    }
-    
-    // build spatial index for input polygons from idx2
-    bool ret = buildIndex(geom_polygons2);
-    if (ret == false) {
-        return -1;
+
+    b.filter = filter_method;
+    if (b.filter == FILTER_AUTO)
+        b.filter = len1 + len2 <= SWEEP_LIMIT ? FILTER_SWEEP : FILTER_RTREE;
+
+    start = std::chrono::steady_clock::now();
+    if (b.filter == FILTER_SWEEP) {
+        double expansion = stop.JOIN_PREDICATE == ST_DWITHIN ? stop.expansion_distance : 0.0;
+        sweep_entry * set1 = loadSweepEntries(poly_set_one, expansion, b.arena);
+        sweep_entry * set2 = loadSweepEntries(poly_set_two, 0.0, b.arena);
+        b.prof.index_time += secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        sweepFilter(set1, len1, set2, len2, candidates);
+        b.prof.filter_time += secondsSince(start);
+    } else {
+        // build spatial index for input polygons from idx2
+        bool ret = buildIndex(poly_set_two, spidx, storage);
+        if (ret == false) {
+            delete spidx;
+            delete storage;
+            return -1;
+        }
+        b.prof.index_time += secondsSince(start);
     }
     // cerr << "len1 = " << len1 << endl;
     // cerr << "len2 = " << len2 << endl;
 
-    for (int i = 0; i < len1; i++) {
-        const Geometry* geom1 = poly_set_one[i];
-        const Envelope * env1 = geom1->getEnvelopeInternal();
-        low[0] = env1->getMinX();
-        low[1] = env1->getMinY();
-        high[0] = env1->getMaxX();
-        high[1] = env1->getMaxY();
-        /* Handle the buffer expansion for R-tree */
-        if (stop.JOIN_PREDICATE == ST_DWITHIN) {
-            low[0] -= stop.expansion_distance;
-            low[1] -= stop.expansion_distance;
-            high[0] += stop.expansion_distance;
-            high[1] += stop.expansion_distance;
-        }
-        Region r(low, high, 2);
-        hits.clear();
-        MyVisitor vis;
-        spidx->intersectsWithQuery(r, vis);
-        //cerr << "j = " << j << " hits: " << hits.size() << endl;
-        for (uint32_t j = 0 ; j < hits.size(); j++ ) 
-        {
-            if (hits[j] == i && selfjoin) {
-                continue;
+    if (tile_threads > 1 && len1 >= split_threshold) {
+        // large tile: all candidates first (the R-tree is only queried
+        // from this thread), then a parallel refinement
+        if (b.filter == FILTER_RTREE) {
+            for (int i = 0; i < len1; i++) {
+                hits.clear();
+                queryProbe(b, spidx, &poly_set_one[i].env, hits);
+                for (size_t k = 0; k < hits.size(); k++)
+                    candidates.push_back(pair<int,int>(i, hits[k]));
             }
-            const Geometry* geom2 = poly_set_two[hits[j]];
-            const Envelope * env2 = geom2->getEnvelopeInternal();
-            if (join_with_predicate(geom1, geom2, env1, env2,
-                    stop.JOIN_PREDICATE))  {
-              ReportResult(i,hits[j]);
-              pairs++;
+        }
+        b.prof.candidates += candidates.size();
+        resetCounts(w, js, len1, len2);
+        pairs = refineSplit(b, js, candidates, w);
+    } else {
+        resetCounts(w, js, len1, len2);
+        for (int i = 0; i < len1; i++) {
+            hits.clear();
+            if (b.filter == FILTER_SWEEP) {
+                // the candidates of probe i are next in the sorted list
+                while (next_candidate < candidates.size() && candidates[next_candidate].first == i)
+                    hits.push_back(candidates[next_candidate++].second);
+            } else {
+                queryProbe(b, spidx, &poly_set_one[i].env, hits);
             }
+            //cerr << "j = " << j << " hits: " << hits.size() << endl;
+            if (hits.empty())
+                continue;
+            b.prof.candidates += hits.size();
+            refineProbe(b, w, js, i, hits);
         }
+        pairs = w.pairs;
     }
+
+    // the counting outputs are written once the tile is refined
+    start = std::chrono::steady_clock::now();
+    if (output_mode == OUTPUT_COUNT && pairs > 0)
+        out.append(b.tile_id).append(TAB).append((long) pairs).append('\n');
+    if (output_mode == OUTPUT_COUNT_LEFT && pairs > 0)
+        reportCounts(b, js, w, out);
+    if (join_mode != JOIN_PAIRS && pairs >= 0)
+        pairs = reportObjects(b, js, w, out);
+    b.prof.output_time += secondsSince(start);
   } // end of try
   //catch (Tools::Exception& e) {
   catch (...) {
     std::cerr << "******ERROR******" << std::endl;
     //std::string s = e.what();
     //std::cerr << s << std::endl;
-    return -1;
+    pairs = -1;
   } // end of catch
+
+  addProfile(b.prof, w.prof);
+  delete spidx;
+  delete storage;
   return pairs ;
 }
 
+/* Moves the objects of the bucket to the spill files of the tile (one
+ * per set), when the tile is over --mem-limit. The geometries are not
+ * parsed yet, only the MBRs, WKT (WKB) and output rows are written. */
+bool spillBucket(tile_bucket & b, SpillFile * spill)
+{
+  for (int sid = SID_1; sid <= stop.join_cardinality; sid++) {
+    SpillFile & file = spill[sid - 1];
+    if (!file.isOpen() && !file.open()) {
+      std::cerr << "******Cannot create a spill file******" << std::endl;
+      return false;
+    }
+    std::vector<tile_object> & objects = b.polydata[sid];
+    for (size_t k = 0; k < objects.size(); k++) {
+      const Envelope & env = objects[k].env;
+      double mbr[4] = { env.getMinX(), env.getMinY(), env.getMaxX(), env.getMaxY() };
+      if (!file.append(mbr, objects[k].shape, objects[k].shape_len, b.rawdata[sid][k])) {
+        std::cerr << "******Cannot write a spill file******" << std::endl;
+        return false;
+      }
+    }
+    b.spilled[sid] += objects.size();
+    releaseSet(b, sid);
+  }
+  b.arena.reset();
+  b.bytes = 0;
+  return true;
+}
+
+/* Loads the next objects of a spill file into a set of the bucket, up to
+ * limit bytes (at least one object). Returns the number of objects. */
+size_t loadBlock(tile_bucket & b, SpillFile & file, int sid, TileArena & arena, size_t limit)
+{
+  string shape, row;
+  size_t count = 0;
+  size_t start_bytes = b.bytes;
+  double mbr[4];
+
+  while ((count == 0 || b.bytes - start_bytes < limit) && file.next(mbr, shape, row)) {
+    addObject(b, sid, mbr[0], mbr[1], mbr[2], mbr[3], shape.data(), shape.size(),
+        arena.copy(row.data(), row.size()), arena);
+    count++;
+  }
+  return count;
+}
+
+/* Block nested loop join of a tile spilled by --mem-limit. Blocks of the
+ * first set filling half of the budget are loaded one after the other,
+ * and the second set (again the first one for a self-join) is streamed
+ * against each of them in blocks filling the other half. The results of
+ * every block pair are written out right away. Returns the number of
+ * results, -1 on error. */
+int blockJoin(tile_bucket & b, SpillFile * spill, ResultBuffer & out)
+{
+  bool selfjoin = stop.join_cardinality == 1;
+  // a symmetric self-join only needs the blocks from the outer one on
+  bool symmetric = selfjoin && symmetric_mode != SYMMETRIC_OFF
+      && symmetricPredicate(stop.JOIN_PREDICATE) && join_mode == JOIN_PAIRS;
+  SpillFile & outer = spill[0];
+  SpillFile & inner = selfjoin ? spill[0] : spill[1];
+  TileArena outer_arena;
+  std::streampos outer_start, outer_end;
+  std::chrono::steady_clock::time_point start;
+  long base1 = 0;
+  int pairs = 0;
+
+  b.block = true;
+  outer.seek(0);
+  while (pairs >= 0) {
+    outer_start = outer.tell();
+    size_t count1 = loadBlock(b, outer, SID_1, outer_arena, mem_limit / 2);
+    if (count1 == 0)
+      break;
+    outer_end = outer.tell();
+
+    long base2 = symmetric ? base1 : 0;
+    inner.seek(symmetric ? outer_start : std::streampos(0));
+    size_t count2 = loadBlock(b, inner, SID_2, b.arena, mem_limit / 2);
+    // an anti join reports the outer block also without a second set
+    bool empty = count2 == 0 && join_mode == JOIN_ANTI;
+    while (count2 > 0 || empty) {
+      b.base1 = base1;
+      b.base2 = base2;
+      int block_pairs = joinBucket(b, out);
+      start = std::chrono::steady_clock::now();
+      out.write(cout);
+      out.clear();
+      b.prof.output_time += secondsSince(start);
+      releaseSet(b, SID_2);
+      b.arena.reset();
+      if (block_pairs < 0) {
+        pairs = -1;
+        break;
+      }
+      pairs += block_pairs;
+      base2 += count2;
+      empty = false;
+      count2 = loadBlock(b, inner, SID_2, b.arena, mem_limit / 2);
+    }
+
+    releaseSet(b, SID_1);
+    outer_arena.reset();
+    base1 += count1;
+    outer.seek(outer_end);
+  }
+
+  b.block = false;
+  b.bytes = 0;
+  spill[0].close();
+  spill[1].close();
+  return pairs;
+}
+
+// joins a tile, from memory or from its spill files
+int joinTile(tile_bucket & b, SpillFile * spill, ResultBuffer & out)
+{
+  if (!spill[0].isOpen())
+    return joinBucket(b, out);
+  if (!spillBucket(b, spill))
+    return -1;
+  return blockJoin(b, spill, out);
+}
+
 bool extractParams(int argc, char** argv ){ 
   /* getopt_long stores the option index here. */
   int option_index = 0;
@@ -511,11 +1678,24 @@ bool extractParams(int argc, char** argv ){
     {"fields",     required_argument, 0, 'f'},
     {"stats",     required_argument, 0, 's'},
     {"tileid",     required_argument, 0, 't'},
+    {"threads",    required_argument, 0, 'n'},
+    {"ordered",    required_argument, 0, 'r'},
+    {"parsers",    required_argument, 0, 'a'},
+    {"partfile",   required_argument, 0, 'x'},
+    {"filter",     required_argument, 0, 'l'},
+    {"output",     required_argument, 0, 'o'},
+    {"profile",    required_argument, 0, 'P'},
+    {"symmetric",  required_argument, 0, 'y'},
+    {"tile-threads",     required_argument, 0, 'k'},
+    {"split-threshold",  required_argument, 0, 'c'},
+    {"mem-limit",  required_argument, 0, 'm'},
+    {"binary",     required_argument, 0, 'b'},
+    {"mode",       required_argument, 0, 'e'},
     {0, 0, 0, 0}
   };
 
   int c;
-  while ((c = getopt_long (argc, argv, "p:i:j:d:f:s:t:",long_options, &option_index)) != -1){
+  while ((c = getopt_long (argc, argv, "p:i:j:d:f:s:t:n:r:a:x:l:o:P:y:k:c:m:b:e:",long_options, &option_index)) != -1){
     switch (c)
     {
       case 0:
@@ -560,6 +1740,102 @@ bool extractParams(int argc, char** argv ){
 	appendTileID = (strcmp(optarg, "true") == 0); 
         break;
 
+      case 'n':
+        num_threads = strtol(optarg, NULL, 10);
+        break;
+
+      case 'r':
+        ordered_output = (strcmp(optarg, "false") != 0);
+        break;
+
+      case 'a':
+        num_parsers = strtol(optarg, NULL, 10);
+        break;
+
+      case 'k':
+        tile_threads = strtol(optarg, NULL, 10);
+        break;
+
+      case 'c':
+        split_threshold = strtol(optarg, NULL, 10);
+        break;
+
+      case 'm':
+        mem_limit = (size_t) strtol(optarg, NULL, 10) << 20;
+        break;
+
+      case 'b':
+        binary_input = (strcmp(optarg, "true") == 0);
+        break;
+
+      case 'l':
+        if (strcmp(optarg, "sweep") == 0)
+          filter_method = FILTER_SWEEP;
+        else if (strcmp(optarg, "rtree") == 0)
+          filter_method = FILTER_RTREE;
+        else if (strcmp(optarg, "auto") == 0)
+          filter_method = FILTER_AUTO;
+        else {
+          cerr << "Unknown filter method [" << optarg << "]." << endl ;
+          return false;
+        }
+        break;
+
+      case 'o':
+        if (strcmp(optarg, "full") == 0)
+          output_mode = OUTPUT_FULL;
+        else if (strcmp(optarg, "ids") == 0)
+          output_mode = OUTPUT_IDS;
+        else if (strcmp(optarg, "count") == 0)
+          output_mode = OUTPUT_COUNT;
+        else if (strcmp(optarg, "count-per-left") == 0)
+          output_mode = OUTPUT_COUNT_LEFT;
+        else {
+          cerr << "Unknown output format [" << optarg << "]." << endl ;
+          return false;
+        }
+        break;
+
+      case 'e':
+        if (strcmp(optarg, "join") == 0)
+          join_mode = JOIN_PAIRS;
+        else if (strcmp(optarg, "semi") == 0)
+          join_mode = JOIN_SEMI;
+        else if (strcmp(optarg, "anti") == 0)
+          join_mode = JOIN_ANTI;
+        else {
+          cerr << "Unknown join mode [" << optarg << "]." << endl ;
+          return false;
+        }
+        break;
+
+      case 'y':
+        if (strcmp(optarg, "once") == 0)
+          symmetric_mode = SYMMETRIC_ONCE;
+        else if (strcmp(optarg, "both") == 0)
+          symmetric_mode = SYMMETRIC_BOTH;
+        else {
+          cerr << "Unknown symmetric mode [" << optarg << "]." << endl ;
+          return false;
+        }
+        break;
+
+      case 'P':
+        profile_file.open(optarg);
+        if (!profile_file) {
+          cerr << "Profile file [" << optarg << "] can NOT be opened." << endl ;
+          return false;
+        }
+        profiling = true;
+        break;
+
+      case 'x':
+        if (!partitions.load(optarg)) {
+          cerr << "Partition file [" << optarg << "] can NOT be loaded." << endl ;
+          return false;
+        }
+        break;
+
       case '?':
         return false;
         /* getopt_long already printed an error message. */
@@ -588,18 +1864,27 @@ bool extractParams(int argc, char** argv ){
     cerr << "Geometry field indexes are NOT set properly. Please refer to the documentation." << endl ;
     return false; 
   }
+  if (num_threads < 0 || num_parsers < 1)
+  {
+    cerr << "Number of threads is NOT set properly. Please refer to the documentation." << endl ;
+    return false; 
+  }
+  if (join_mode != JOIN_PAIRS && (output_mode == OUTPUT_COUNT || output_mode == OUTPUT_COUNT_LEFT))
+  {
+    cerr << "The semi and anti joins report objects, not pairs: use --output full or ids." << endl ;
+    return false;
+  }
+  if (mem_limit > 0 && num_threads > 0)
+  {
+    cerr << "--mem-limit runs the sequential engine, --threads is ignored." << endl ;
+    num_threads = 0;
+  }
 
   print_stop();
 
   return true;
 }
 
-void freeObjects() {
-    // garbage collection
-    delete spidx;
-    delete storage;
-}
-
 void usage(){
   cerr  << endl << "Usage: resque [OPTIONS]" << endl << "OPTIONS:" << endl;
   cerr << TAB << "-p,  --predicate" << TAB <<  "The spatial join predicate for query processing. Acceptable values are [st_intersects, " 
@@ -608,12 +1893,43 @@ void usage(){
   cerr << TAB << "-j, --shpidx2"  << TAB << "The index of the geometry field from the smaller dataset. Index value starts from 1." << endl;
   cerr << TAB << "-d, --distance" << TAB << "Used together with st_dwithin predicate to indicates the join distance." 
       << "This field has no effect o other join predicates." << endl;
-  cerr << TAB << "-s, --stats"  << TAB << "[true | false] Include the tileID as the last field of the output" << endl;
-  cerr << TAB << "-t, --tileID"  << TAB << "[true | false] Include the statistics in the join output for intersection: area of object 1, area of object 2, union area, intersect area, Jaccard coefficient (tab-separated)." << endl;
+  cerr << TAB << "-s, --stats"  << TAB << "[true | false] Include the statistics in the join output for intersection: area of object 1, area of object 2, union area, intersect area, Jaccard coefficient (tab-separated)." << endl;
+  cerr << TAB << "-t, --tileID"  << TAB << "[true | false] Include the tileID as the last field of the output" << endl;
   cerr << TAB << "-f, --fields"   << TAB << "Output field election parameter. Fields from different dataset are separated with a colon (:), " 
       <<"and fields from the same dataset are separated with a comma (,). For example: if we want to only output fields 1, 3, and 5 from " 
       << "the first dataset (indicated with param -i), and output fields 1, 2, and 9 from the second dataset (indicated with param -j) "
       << " then we can provide an option such as: --fields 1,3,5:1,2,9 " << endl;
+  cerr << TAB << "-n, --threads"  << TAB << "Number of join threads. When set, input reading, WKT parsing and joining run as a pipeline "
+      << "of concurrent stages, and up to this many tiles are joined in parallel. The default is 0 (sequential processing)." << endl;
+  cerr << TAB << "-a, --parsers"  << TAB << "Number of WKT parsing threads in the pipeline. The default is 1." << endl;
+  cerr << TAB << "-r, --ordered"  << TAB << "[true | false] In the pipelined mode, write the results of tiles in input order. The default is true." << endl;
+  cerr << TAB << "-x, --partfile" << TAB << "The partition file (tile boundaries) used by the mapper. When given, a pair of objects copied to several tiles "
+      << "is reported only once, by the tile that contains the lower left corner of the intersection of their MBRs." << endl;
+  cerr << TAB << "-l, --filter"   << TAB << "[sweep | rtree | auto] The MBR filter of a tile: a plane sweep over both sets sorted by x, or an R-tree "
+      << "built on the second set. auto uses the plane sweep for tiles of up to " << SWEEP_LIMIT << " objects. The default is auto." << endl;
+  cerr << TAB << "-y, --symmetric" << TAB << "[once | both] Self-join (-i only) with a symmetric predicate (all but st_contains and st_within): "
+      << "each unordered pair is refined once, and reported once (once) or in both orientations (both). "
+      << "By default every ordered pair is refined on its own." << endl;
+  cerr << TAB << "-k, --tile-threads" << TAB << "Number of threads refining the candidate pairs of a large tile. The output is the same as "
+      << "with sequential refinement. The default is 0 (tiles are refined by a single thread)." << endl;
+  cerr << TAB << "-c, --split-threshold" << TAB << "Number of objects of the first set above which a tile is refined by the "
+      << "--tile-threads threads. The default is 50000." << endl;
+  cerr << TAB << "-m, --mem-limit" << TAB << "Memory budget of a tile in MB. The objects of a tile over the budget are spilled "
+      << "to temporary files (in $TMPDIR) and joined block by block. Uses the sequential engine (no --threads). "
+      << "The default is 0 (no limit)." << endl;
+  cerr << TAB << "-b, --binary"   << TAB << "[true | false] The input is binary tile records (rawbytes frames) written by "
+      << "partitionMapperJoin --binary: MBRs are not scanned and geometries are read from WKB. The geometry field of the output "
+      << "rows is empty. The default is false." << endl;
+  cerr << TAB << "-P, --profile"  << TAB << "Write a profile record per tile to the given file, as one JSON object per line: objects, filter, "
+      << "time spent parsing, building the index, filtering, refining and writing output (ms), candidate pairs, results and peak memory." << endl;
+  cerr << TAB << "-o, --output"   << TAB << "[full | ids | count | count-per-left] full writes the selected fields of both objects of a pair, "
+      << "ids only the first selected field of each object (by default the object id). count writes no pairs but the tile id and "
+      << "its number of pairs, count-per-left the first selected field of each object of the first set with matches and its "
+      << "number of matches. Counts of the same key add up across tiles (hgdeduplicater.py sum). The default is full." << endl;
+  cerr << TAB << "-e, --mode"     << TAB << "[join | semi | anti] join reports the matching pairs. semi reports the selected fields of "
+      << "each object of the first set with a match, anti of each object of the first set followed by 1 (a match in the tile) "
+      << "or 0 (none). The refinement of an object stops at its first match. Objects copied to several tiles are reported "
+      << "by each: hgdeduplicater.py uniq (semi) or anti on the sorted rows gives each object once. The default is join." << endl;
 }
 
 // main body of the engine
@@ -634,7 +1950,7 @@ int main(int argc, char** argv)
   switch (stop.join_cardinality){
     case 1:
     case 2:
-      c = mJoinQuery();
+      c = num_threads > 0 ? mJoinQueryThreaded() : mJoinQuery();
       // std::cerr <<"ERROR: input data parsing error." << std::endl << "Please see documentations, or contact author." << std::endl;
       break;
 
@@ -650,8 +1966,6 @@ int main(int argc, char** argv)
     std::cerr <<"Error: ill formatted data. Terminating ....... " << std::endl;
     return 1;
   }
-  freeObjects();
-  
   cout.flush();
   cerr.flush();
   return 0;
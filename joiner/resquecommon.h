@@ -15,13 +15,17 @@
 #include <geos/geom/Point.h>
 #include <geos/io/WKTReader.h>
 #include <geos/io/WKTWriter.h>
+#include <geos/io/WKBReader.h>
 #include <geos/opBuffer.h>
+#include <geos/geom/prep/PreparedGeometry.h>
+#include <geos/geom/prep/PreparedGeometryFactory.h>
 
 #include <spatialindex/SpatialIndex.h>
 
 using namespace geos;
 using namespace geos::io;
 using namespace geos::geom;
+using namespace geos::geom::prep;
 using namespace geos::operation::buffer; 
 
 using namespace SpatialIndex;
@@ -65,17 +69,24 @@ RTree::Data* parseInputPolygon(Geometry *p, id_type m_id);
 class MyVisitor : public IVisitor
 {
     public:
+	// by default hits are collected in the global container;
+	// threaded callers pass their own
+	MyVisitor() : m_hits(hits) {}
+	MyVisitor(vector<id_type> & h) : m_hits(h) {}
+
 	void visitNode(const INode& n) {}
 	void visitData(std::string &s) {}
 
 	void visitData(const IData& d)
 	{
-	    hits.push_back(d.getIdentifier());
+	    m_hits.push_back(d.getIdentifier());
 	    //std::cout << d.getIdentifier()<< std::endl;
 	}
 
 	void visitData(std::vector<const IData*>& v) {}
 	void visitData(std::vector<uint32_t>& v){}
+
+	vector<id_type> & m_hits;
 };
 
 
@@ -0,0 +1,69 @@
+#ifndef RESULTBUFFER_H
+#define RESULTBUFFER_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <ostream>
+
+/* Output buffer for the joined pairs of a tile. Rows are appended as raw
+ * bytes and written out in one call at the tile boundary, instead of
+ * going through a stream (and a flush) for every pair. The storage is
+ * kept by clear(), so the buffer stops growing after the largest tile.
+ * A buffer with a sink writes its rows out once it holds flush_bytes, so
+ * a tile with a huge result does not have to fit in memory. Buffers
+ * handed over whole (threaded paths, which keep the output order) have
+ * no sink. */
+class ResultBuffer
+{
+  public:
+    ResultBuffer(size_t reserve = 1 << 20) : sink(NULL), flush_bytes(0) { data.reserve(reserve); }
+
+    void setSink(std::ostream * out, size_t bytes) { sink = out; flush_bytes = bytes; }
+
+    ResultBuffer & append(const char * s) { data.append(s, strlen(s)); return *this; }
+    ResultBuffer & append(const std::string & s) { data.append(s); return *this; }
+    ResultBuffer & append(char c) { data.push_back(c); return *this; }
+    ResultBuffer & append(const ResultBuffer & other) { data.append(other.data); return *this; }
+
+    // same text as "ostream << value" with the default precision
+    ResultBuffer & append(double value)
+    {
+      char num[32];
+      int len = snprintf(num, sizeof(num), "%g", value);
+      data.append(num, len);
+      return *this;
+    }
+
+    ResultBuffer & append(long value)
+    {
+      char num[32];
+      int len = snprintf(num, sizeof(num), "%ld", value);
+      data.append(num, len);
+      return *this;
+    }
+
+    // ends a row, the buffer is flushed to the sink only between rows
+    ResultBuffer & endRow() { data.push_back('\n'); flushIfFull(); return *this; }
+
+    void flushIfFull()
+    {
+      if (sink != NULL && data.size() >= flush_bytes) {
+        write(*sink);
+        clear();
+      }
+    }
+
+    size_t size() const { return data.size(); }
+
+    void write(std::ostream & out) const { out.write(data.data(), data.size()); }
+
+    void clear() { data.clear(); }
+
+  private:
+    std::string data;
+    std::ostream * sink;
+    size_t flush_bytes;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef SKEWINDEX_H
+#define SKEWINDEX_H
+
+#include <stdint.h>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "packedindex.h"
+
+/* The cached dataset of skewresque prepared by skewprep: the geometries
+ * as WKB, the output rows and a PackedRTree on the MBRs, in one file that
+ * every task maps in memory and uses read only, without parsing the WKT
+ * or building an index at startup. The file is
+ *
+ *   char[8] "SKEWIDX1"
+ *   uint64  number of objects, offset of the tree, offset of the object table
+ *   the tree (packedindex.h), object k has id k
+ *   uint64  offset of every object, then for each object
+ *           uint32 length and the WKB geometry, the output row and '\0'
+ *
+ * Numbers are in the native byte order of the machine running skewprep. */
+const char SKEWINDEX_MAGIC[8] = { 'S', 'K', 'E', 'W', 'I', 'D', 'X', '1' };
+const uint32_t SKEWINDEX_NODE_SIZE = 16;
+
+class SkewIndex
+{
+  public:
+    SkewIndex() : data(NULL), len(0), count(0), table(NULL) {}
+    ~SkewIndex() { close(); }
+
+    // writes the prepared dataset, shapes[k] is the WKB of object k
+    static bool write(const char * path, const std::vector<packed_box> & boxes,
+        const std::vector<std::string> & shapes, const std::vector<std::string> & rows)
+    {
+      std::ofstream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+      std::string tree;
+      PackedRTree::pack(boxes, SKEWINDEX_NODE_SIZE, tree);
+
+      uint64_t header[3];
+      header[0] = boxes.size();
+      header[1] = sizeof(SKEWINDEX_MAGIC) + sizeof(header);
+      header[2] = header[1] + tree.size();
+      out.write(SKEWINDEX_MAGIC, sizeof(SKEWINDEX_MAGIC));
+      out.write(reinterpret_cast<const char*>(header), sizeof(header));
+      out.write(tree.data(), tree.size());
+
+      uint64_t offset = header[2] + boxes.size() * sizeof(uint64_t);
+      for (size_t k = 0; k < boxes.size(); k++) {
+        out.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        offset += sizeof(uint32_t) + shapes[k].size() + rows[k].size() + 1;
+      }
+      for (size_t k = 0; k < boxes.size(); k++) {
+        uint32_t shape_len = shapes[k].size();
+        out.write(reinterpret_cast<const char*>(&shape_len), sizeof(shape_len));
+        out.write(shapes[k].data(), shape_len);
+        out.write(rows[k].c_str(), rows[k].size() + 1);
+      }
+      out.close();
+      return !out.fail();
+    }
+
+    bool open(const char * path)
+    {
+      int fd = ::open(path, O_RDONLY);
+      struct stat st;
+      if (fd < 0)
+        return false;
+      if (fstat(fd, &st) != 0 || st.st_size < (off_t) (sizeof(SKEWINDEX_MAGIC) + 3 * sizeof(uint64_t))) {
+        ::close(fd);
+        return false;
+      }
+      void * map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED)
+        return false;
+      data = static_cast<const char*>(map);
+      len = st.st_size;
+
+      const uint64_t * header = reinterpret_cast<const uint64_t*>(data + sizeof(SKEWINDEX_MAGIC));
+      count = header[0];
+      if (memcmp(data, SKEWINDEX_MAGIC, sizeof(SKEWINDEX_MAGIC)) != 0
+          || header[1] > header[2] || header[2] + count * sizeof(uint64_t) > len
+          || !rtree.attach(data + header[1], header[2] - header[1]) || rtree.size() != count) {
+        close();
+        return false;
+      }
+      table = reinterpret_cast<const uint64_t*>(data + header[2]);
+      return true;
+    }
+
+    void close()
+    {
+      if (data != NULL)
+        munmap(const_cast<char*>(data), len);
+      data = NULL;
+      len = 0;
+      count = 0;
+      table = NULL;
+    }
+
+    size_t size() const { return count; }
+
+    const PackedRTree & tree() const { return rtree; }
+
+    // the WKB geometry of object k
+    const char * shape(size_t k, uint32_t & shape_len) const
+    {
+      const char * pos = data + table[k];
+      memcpy(&shape_len, pos, sizeof(shape_len));
+      return pos + sizeof(shape_len);
+    }
+
+    // the output row of object k
+    const char * row(size_t k) const
+    {
+      uint32_t shape_len;
+      const char * wkb = shape(k, shape_len);
+      return wkb + shape_len;
+    }
+
+  private:
+    const char * data;
+    size_t len;
+    size_t count;
+    const uint64_t * table;
+    PackedRTree rtree;
+};
+
+#endif
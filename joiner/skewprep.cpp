@@ -0,0 +1,159 @@
+#include "resquecommon.h"
+#include <geos/io/WKBWriter.h>
+#include <fstream>
+#include <sstream>
+#include "skewindex.h"
+
+/* Prepares the cached dataset of skewresque once: parses its WKT, and
+ * writes the WKB geometries, the output rows and a packed R-tree on the
+ * MBRs to one file (skewindex.h). Tasks started with skewresque --index
+ * map that file instead of parsing hgskewinput and building an index. */
+
+string input_file = "hgskewinput";
+string output_file = "hgskewinput.idx";
+int shape_idx = -1;
+vector<int> proj;
+
+// the selected fields of a record, the whole record when none is selected
+string project(const string & input_line, vector<field_t> & fields)
+{
+  if (proj.size() == 0)
+    return input_line;
+  std::stringstream ss;
+  for (size_t i = 0; i < proj.size(); i++) {
+    if (proj[i] >= (int) fields.size())
+      continue;
+    if (i > 0)
+      ss << TAB;
+    ss.write(fields[proj[i]].ptr, fields[proj[i]].len);
+  }
+  return ss.str();
+}
+
+int prepare()
+{
+  string input_line;
+  vector<field_t> fields;
+  vector<packed_box> boxes;
+  vector<string> shapes;
+  vector<string> rows;
+  PrecisionModel *pm = new PrecisionModel();
+  GeometryFactory *gf = new GeometryFactory(pm,OSM_SRID);
+  WKTReader *wkt_reader = new WKTReader(gf);
+  WKBWriter wkb_writer;
+  std::ostringstream wkb;
+  Geometry *poly = NULL;
+
+  std::ifstream inFile(input_file.c_str());
+  if (!inFile) {
+    std::cerr << "Input file [" << input_file << "] can NOT be opened." << std::endl;
+    return -1;
+  }
+  while (std::getline(inFile, input_line))
+  {
+    split(input_line, fields);
+    // same objects as skewresque reading hgskewinput
+    if (shape_idx >= (int) fields.size() || fields[shape_idx].len < 4)
+      continue ; // empty spatial object
+
+    try {
+      poly = wkt_reader->read(fields[shape_idx].str());
+    }
+    catch (...) {
+      std::cerr << "******Geometry Parsing Error******" << std::endl;
+      return -1;
+    }
+
+    const Envelope * env = poly->getEnvelopeInternal();
+    packed_box box = { env->getMinX(), env->getMinY(), env->getMaxX(), env->getMaxY() };
+    boxes.push_back(box);
+    wkb.str(string());
+    wkb_writer.write(*poly, wkb);
+    shapes.push_back(wkb.str());
+    rows.push_back(project(input_line, fields));
+    delete poly;
+  }
+  inFile.close();
+
+  if (!SkewIndex::write(output_file.c_str(), boxes, shapes, rows)) {
+    std::cerr << "Output file [" << output_file << "] can NOT be written." << std::endl;
+    return -1;
+  }
+
+  delete wkt_reader;
+  delete gf;
+  delete pm;
+  return boxes.size();
+}
+
+bool extractParams(int argc, char** argv ){
+  int option_index = 0;
+  opterr = 0 ;
+  struct option long_options[] =
+  {
+    {"shpidx2",  required_argument, 0, 'j'},
+    {"fields",   required_argument, 0, 'f'},
+    {"input",    required_argument, 0, 'i'},
+    {"output",   required_argument, 0, 'o'},
+    {0, 0, 0, 0}
+  };
+
+  int c;
+  vector<string> selec;
+  while ((c = getopt_long (argc, argv, "j:f:i:o:",long_options, &option_index)) != -1){
+    switch (c)
+    {
+      case 'j':
+        shape_idx = strtol(optarg, NULL, 10) - 1;
+        break;
+
+      case 'f':
+        selec.clear();
+        tokenize(string(optarg), selec, ",");
+        for (size_t i = 0; i < selec.size(); i++)
+          proj.push_back(atoi(selec[i].c_str()) - 1);
+        break;
+
+      case 'i':
+        input_file = optarg;
+        break;
+
+      case 'o':
+        output_file = optarg;
+        break;
+
+      default:
+        return false;
+    }
+  }
+
+  if (shape_idx < 0)
+  {
+    cerr << "Geometry field index is NOT set properly. Please refer to the documentation." << endl ;
+    return false;
+  }
+  return true;
+}
+
+void usage(){
+  cerr  << endl << "Usage: skewprep [OPTIONS]" << endl << "OPTIONS:" << endl;
+  cerr << TAB << "-j, --shpidx2"  << TAB << "The index of the geometry field of the cached dataset. Index value starts from 1." << endl;
+  cerr << TAB << "-f, --fields"   << TAB << "The fields of the cached dataset in the output, comma separated (the part after the colon of "
+      << "skewresque --fields). By default the whole record." << endl;
+  cerr << TAB << "-i, --input"    << TAB << "The cached dataset. The default is hgskewinput." << endl;
+  cerr << TAB << "-o, --output"   << TAB << "The prepared file, used with skewresque --index. The default is hgskewinput.idx." << endl;
+}
+
+int main(int argc, char** argv)
+{
+  if (!extractParams(argc,argv)) {
+    usage();
+    return 1;
+  }
+
+  int c = prepare();
+  if (c < 0)
+    return 1;
+  std::cerr << "Prepared objects: [" << c << "]" << std::endl;
+  return 0;
+}
@@ -1,7 +1,15 @@
 #include "resquecommon.h"
+#include "skewindex.h"
 
 const string cacheFile= "hgskewinput"; // default hdfs cache file name 
 const int OBJECT_LIMIT= 5000;
+/* Memory estimate of an object for --mem-limit, besides its WKT text
+ * (counted twice: the text and the parsed coordinates) and its output
+ * row: the index entry and the GEOS geometry headers. */
+const size_t OBJECT_OVERHEAD = 256;
+
+// memory budget in bytes, 0 for batches of OBJECT_LIMIT objects
+size_t mem_limit = 0;
 
 // data type declaration 
 map<int, std::vector<Geometry*> > polydata;
@@ -9,6 +17,13 @@ map<int, std::vector<string> > rawdata;
 ISpatialIndex * spidx = NULL;
 IStorageManager * storage = NULL;
 
+// the cached dataset prepared by skewprep (--index), mapped read only;
+// its geometries are decoded from WKB when they are first refined
+SkewIndex cache_index;
+bool cache_mapped = false;
+vector<Geometry*> cache_geoms;
+WKBReader * wkb_reader = NULL;
+
 struct query_op { 
   int JOIN_PREDICATE;
   int shape_idx_1;
@@ -28,9 +43,12 @@ int getJoinPredicate(char * predicate_str);
 void setProjectionParam(char * arg);
 bool extractParams(int argc, char** argv );
 void ReportResult( int i , int j);
-string project( vector<string> & fields, int sid);
+string project( vector<field_t> & fields, int sid);
 void freeObjects();
-bool buildIndex(map<int,Geometry*> & geom_polygons);
+bool buildIndex(std::vector<Geometry*> & geoms);
+const Geometry * cachedGeometry(id_type j);
+const char * cachedRow(int j);
+size_t cachedCount();
 
 void init(){
   // initlize query operator 
@@ -48,6 +66,8 @@ void print_stop(){
   std::cerr << "shape index 1: " << stop.shape_idx_1 << std::endl;
   std::cerr << "shape index 2: " << stop.shape_idx_2 << std::endl;
   std::cerr << "join cardinality: " << stop.join_cardinality << std::endl;
+  std::cerr << "memory limit: " << (mem_limit >> 20) << "MB" << std::endl;
+  std::cerr << "cached dataset: " << (cache_mapped ? "prepared" : cacheFile) << std::endl;
   std::cerr << "selected fields :" ;
   
   for (int i =0 ; i < stop.proj1.size(); i++)
@@ -67,85 +87,111 @@ void print_stop(){
 int mJoinQuery()
 {
   string input_line;
-  vector<string> fields;
+  vector<field_t> fields;
   PrecisionModel *pm = new PrecisionModel();
   GeometryFactory *gf = new GeometryFactory(pm,OSM_SRID);
   WKTReader *wkt_reader = new WKTReader(gf);
   Geometry *poly = NULL;
-  Geometry *buffer_poly = NULL;
+  size_t cache_bytes = 0;
+  size_t batch_bytes = 0;
+  size_t batch_limit = 0;
 
   int object_counter = 0;
-  // parse the cache file from Distributed Cache
+  if (cache_mapped) {
+    wkb_reader = new WKBReader(*gf);
+    cache_geoms.assign(cache_index.size(), NULL);
+  }
+  // parse the cache file from Distributed Cache, unless it is prepared
   std::ifstream skewFile(cacheFile);
-  while (std::getline(skewFile, input_line))
+  while (!cache_mapped && std::getline(skewFile, input_line))
   {
-    tokenize(input_line, fields, TAB, true);
-    if (fields[stop.shape_idx_2].size() < 4) // this number 4 is really arbitrary
+    split(input_line, fields);
+    if (stop.shape_idx_2 >= fields.size() || fields[stop.shape_idx_2].len < 4) // this number 4 is really arbitrary
       continue ; // empty spatial object 
 
     try { 
-      poly = wkt_reader->read(fields[stop.shape_idx_2]);
+      poly = wkt_reader->read(fields[stop.shape_idx_2].str());
     }
     catch (...) {
       std::cerr << "******Geometry Parsing Error******" << std::endl;
       return -1;
     }
 
-    if (ST_DWITHIN == stop.JOIN_PREDICATE && stop.expansion_distance != 0.0 )
-    {
-      buffer_poly = poly ;
-      poly = BufferOp::bufferOp(buffer_poly,stop.expansion_distance,0,BufferParameters::CAP_SQUARE);
-      delete buffer_poly ;
-    }
-
     polydata[SID_2].push_back(poly);
     //--- a better engine implements projection 
     rawdata[SID_2].push_back(stop.proj2.size()>0 ? project(fields,SID_2) : input_line); 
-
-    fields.clear();
+    cache_bytes += 2 * fields[stop.shape_idx_2].len + rawdata[SID_2].back().size() + OBJECT_OVERHEAD;
   }
   skewFile.close();
-  // update predicate to st_intersects
-  if (ST_DWITHIN == stop.JOIN_PREDICATE )
-    stop.JOIN_PREDICATE = ST_INTERSECTS ;
+
+  // the cached dataset is indexed once, the batches of the main dataset
+  // are probed against it
+  if (stop.join_cardinality == 2 && !polydata[SID_2].empty()) {
+    try {
+      if (!buildIndex(polydata[SID_2])) {
+        std::cerr << "******Index Error******" << std::endl;
+        return -1;
+      }
+    }
+    catch (...) {
+      std::cerr << "******Index Error******" << std::endl;
+      return -1;
+    }
+  }
+
+  // the batches of the main dataset get what the cached dataset leaves
+  // of the budget, at least a quarter of it
+  if (mem_limit > 0) {
+    batch_limit = cache_bytes < mem_limit * 3 / 4 ? mem_limit - cache_bytes : mem_limit / 4;
+    if (cache_bytes > mem_limit)
+      std::cerr << "cached dataset needs about " << (cache_bytes >> 20) << "MB, over the memory limit" << std::endl;
+  }
 
   // parse the main dataset 
   object_counter = 0;
   while(cin && getline(cin, input_line) && !cin.eof()) {
-    tokenize(input_line, fields, TAB, true);
-    //cerr << "Shape size: " << fields[stop.shape_idx_1].size()<< endl;
-    if (fields[stop.shape_idx_1].size() < 4) // this number 4 is really arbitrary
+    split(input_line, fields);
+    //cerr << "Shape size: " << fields[stop.shape_idx_1].len << endl;
+    if (stop.shape_idx_1 >= fields.size() || fields[stop.shape_idx_1].len < 4) // this number 4 is really arbitrary
       continue ; // empty spatial object 
 
     try { 
       // cerr << "Tweet: " << (object_counter+1) << endl; 
       // cerr.flush();
-      poly = wkt_reader->read(fields[stop.shape_idx_1]);
+      poly = wkt_reader->read(fields[stop.shape_idx_1].str());
     }
     catch (...) {
       std::cerr << "******Geometry Parsing Error******" << std::endl;
       return -1;
     }
 
-    if (object_counter++ % OBJECT_LIMIT == 0 && object_counter >1) {
+    // a batch is full at OBJECT_LIMIT objects, or at the memory budget
+    bool full = mem_limit > 0 ? batch_bytes >= batch_limit : object_counter % OBJECT_LIMIT == 0;
+    if (object_counter++ > 0 && full) {
       int  pairs = joinBucket();
-      std::cerr <<rawdata[SID_1].size() << "|x|" << rawdata[SID_2].size() << "|=|" << pairs << "|" <<std::endl;
+      std::cerr <<rawdata[SID_1].size() << "|x|" << cachedCount() << "|=|" << pairs << "|" <<std::endl;
       releaseShapeMem(1);
+      batch_bytes = 0;
     }
 
     // populate the bucket for join 
     polydata[SID_1].push_back(poly);
     rawdata[SID_1].push_back(stop.proj1.size()>0 ? project(fields,SID_1) : input_line); 
+    batch_bytes += 2 * fields[stop.shape_idx_1].len + rawdata[SID_1].back().size() + OBJECT_OVERHEAD;
 
-    fields.clear();
   }
 
   // last batch 
   int  pairs = joinBucket();
-  std::cerr <<rawdata[SID_1].size() << "|x|" << rawdata[SID_2].size() << "|=|" << pairs << "|" <<std::endl;
+  std::cerr <<rawdata[SID_1].size() << "|x|" << cachedCount() << "|=|" << pairs << "|" <<std::endl;
   releaseShapeMem(stop.join_cardinality);
 
   // clean up newed objects
+  for (size_t j = 0; j < cache_geoms.size(); j++)
+    delete cache_geoms[j];
+  cache_geoms.clear();
+  delete wkb_reader;
+  wkb_reader = NULL;
   delete wkt_reader ;
   delete gf ;
   delete pm ;
@@ -175,10 +221,6 @@ bool join_with_predicate(const Geometry * geom1 , const Geometry * geom2,
   bool flag = false ; 
 //  const Envelope * env1 = geom1->getEnvelopeInternal();
 //  const Envelope * env2 = geom2->getEnvelopeInternal();
-  BufferOp * buffer_op1 = NULL ;
-  BufferOp * buffer_op2 = NULL ;
-  Geometry* geom_buffer1 = NULL;
-  Geometry* geom_buffer2 = NULL;
  
   switch (jp){
 
@@ -211,18 +253,9 @@ bool join_with_predicate(const Geometry * geom1 , const Geometry * geom2,
       break;
 
     case ST_DWITHIN:
-      buffer_op1 = new BufferOp(geom1);
-      // buffer_op2 = new BufferOp(geom2);
-      if (NULL == buffer_op1)
-        cerr << "NULL: buffer_op1" <<endl;
-
-      geom_buffer1 = buffer_op1->getResultGeometry(stop.expansion_distance);
-      // geom_buffer2 = buffer_op2->getResultGeometry(expansion_distance);
-      //Envelope * env_temp = geom_buffer1->getEnvelopeInternal();
-      if (NULL == geom_buffer1)
-        cerr << "NULL: geom_buffer1" <<endl;
-
-      flag = join_with_predicate(geom_buffer1,geom2, env1, env2, ST_INTERSECTS);
+      // exact distance test, the probe MBR is already expanded in the R-tree query
+      flag = env1->distance(env2) <= stop.expansion_distance &&
+          geom1->isWithinDistance(geom2, stop.expansion_distance);
       break;
 
     case ST_WITHIN:
@@ -241,18 +274,18 @@ bool join_with_predicate(const Geometry * geom1 , const Geometry * geom2,
 }
 
 
-string project( vector<string> & fields, int sid) {
+string project( vector<field_t> & fields, int sid) {
   std::stringstream ss;
   switch (sid){
     case 1:
       for (int i =0 ; i <stop.proj1.size();i++)
       {
         if ( 0 == i )
-          ss << fields[stop.proj1[i]] ;
+          ss.write(fields[stop.proj1[i]].ptr, fields[stop.proj1[i]].len) ;
         else
         {
           if (stop.proj1[i] < fields.size())
-            ss << TAB << fields[stop.proj1[i]];
+            (ss << TAB).write(fields[stop.proj1[i]].ptr, fields[stop.proj1[i]].len);
         }
       }
       break;
@@ -260,10 +293,10 @@ string project( vector<string> & fields, int sid) {
       for (int i =0 ; i <stop.proj2.size();i++)
       {
         if ( 0 == i )
-          ss << fields[stop.proj2[i]] ;
+          ss.write(fields[stop.proj2[i]].ptr, fields[stop.proj2[i]].len) ;
         else{ 
           if (stop.proj2[i] < fields.size())
-            ss << TAB << fields[stop.proj2[i]];
+            (ss << TAB).write(fields[stop.proj2[i]].ptr, fields[stop.proj2[i]].len);
         }
       }
       break;
@@ -281,7 +314,7 @@ void ReportResult( int i , int j)
       cout << rawdata[SID_1][i] << SEP << rawdata[SID_1][j] << endl;
       break;
     case 2:
-      cout << rawdata[SID_2][j] << SEP << rawdata[SID_1][i] << endl; 
+      cout << cachedRow(j) << SEP << rawdata[SID_1][i] << endl; 
       break;
     default:
       return ;
@@ -304,18 +337,14 @@ int joinBucket()
     std::vector<Geometry*>  & poly_set_two = polydata[idx2];
 
     int len1 = poly_set_one.size();
-    int len2 = poly_set_two.size();
-    
-    map<int,Geometry*> geom_polygons2;
-    for (int j = 0; j < len2; j++) {
-        geom_polygons2[j] = poly_set_two[j];
-    }
-    
-    // build spatial index for input polygons from idx2
-    bool ret = buildIndex(geom_polygons2);
-    if (ret == false) {
+
+    // a self-join indexes each batch, a join uses the index of the cached dataset
+    if (selfjoin && len1 > 0 && !buildIndex(poly_set_one)) {
         return -1;
     }
+    if ((spidx == NULL && !cache_mapped) || len1 == 0) {
+        return 0;
+    }
     // cerr << "len1 = " << len1 << endl;
     // cerr << "len2 = " << len2 << endl;
 
@@ -334,17 +363,22 @@ int joinBucket()
             high[1] += stop.expansion_distance;
         }
         
-        Region r(low, high, 2);
         hits.clear();
-        MyVisitor vis;
-        spidx->intersectsWithQuery(r, vis);
+        if (cache_mapped && !selfjoin) {
+            packed_box q = { low[0], low[1], high[0], high[1] };
+            cache_index.tree().query(q, hits);
+        } else {
+            Region r(low, high, 2);
+            MyVisitor vis;
+            spidx->intersectsWithQuery(r, vis);
+        }
         //cerr << "j = " << j << " hits: " << hits.size() << endl;
         for (uint32_t j = 0 ; j < hits.size(); j++ ) 
         {
             if (hits[j] == i && selfjoin) {
                 continue;
             }
-            const Geometry* geom2 = poly_set_two[hits[j]];
+            const Geometry* geom2 = cache_mapped && !selfjoin ? cachedGeometry(hits[j]) : poly_set_two[hits[j]];
             const Envelope * env2 = geom2->getEnvelopeInternal();
             if (join_with_predicate(geom1, geom2, env1, env2,
                     stop.JOIN_PREDICATE))  {
@@ -365,7 +399,14 @@ int joinBucket()
 }
 
 
-bool buildIndex(map<int,Geometry*> & geom_polygons) {
+// replaces the spatial index by one on geoms
+bool buildIndex(std::vector<Geometry*> & geoms) {
+    map<int,Geometry*> geom_polygons;
+    for (size_t j = 0; j < geoms.size(); j++) {
+        geom_polygons[j] = geoms[j];
+    }
+    freeObjects();
+
     // build spatial index on tile boundaries 
     id_type  indexIdentifier;
     GEOSDataStream stream(&geom_polygons);
@@ -386,6 +427,30 @@ void freeObjects() {
     // garbage collection
     delete spidx;
     delete storage;
+    spidx = NULL;
+    storage = NULL;
+}
+
+// a geometry of the prepared cached dataset, decoded on first use
+const Geometry * cachedGeometry(id_type j)
+{
+  if (cache_geoms[j] == NULL) {
+    uint32_t len = 0;
+    const char * wkb = cache_index.shape(j, len);
+    std::istringstream in(string(wkb, len));
+    cache_geoms[j] = wkb_reader->read(in);
+  }
+  return cache_geoms[j];
+}
+
+const char * cachedRow(int j)
+{
+  return cache_mapped ? cache_index.row(j) : rawdata[SID_2][j].c_str();
+}
+
+size_t cachedCount()
+{
+  return cache_mapped ? cache_index.size() : rawdata[SID_2].size();
 }
 
 
@@ -401,12 +466,14 @@ bool extractParams(int argc, char** argv ){
     {"shpidx2",  required_argument, 0, 'j'},
     {"predicate",  required_argument, 0, 'p'},
     {"fields",     required_argument, 0, 'f'},
+    {"mem-limit",  required_argument, 0, 'm'},
+    {"index",      required_argument, 0, 'x'},
     {0, 0, 0, 0}
   };
 
 
   int c;
-  while ((c = getopt_long (argc, argv, "p:i:j:d:f:",long_options, &option_index)) != -1){
+  while ((c = getopt_long (argc, argv, "p:i:j:d:f:m:x:",long_options, &option_index)) != -1){
     switch (c)
     {
       case 0:
@@ -443,6 +510,18 @@ bool extractParams(int argc, char** argv ){
         //printf ("projection fields:  `%s'\n", optarg);
         break;
 
+      case 'm':
+        mem_limit = (size_t) strtol(optarg, NULL, 10) << 20;
+        break;
+
+      case 'x':
+        if (!cache_index.open(optarg)) {
+          cerr << "Prepared cache file [" << optarg << "] can NOT be loaded." << endl ;
+          return false;
+        }
+        cache_mapped = true;
+        break;
+
       case '?':
         return false;
         /* getopt_long already printed an error message. */
@@ -471,6 +550,11 @@ bool extractParams(int argc, char** argv ){
     cerr << "Geometry field indexes are NOT set properly. Please refer to the documentation." << endl ;
     return false; 
   }
+  if (cache_mapped && stop.join_cardinality != 2)
+  {
+    cerr << "A prepared cache file (--index) is only used together with -j." << endl ;
+    return false;
+  }
 
   print_stop();
 
@@ -551,6 +635,10 @@ void usage(){
       <<"and fields from the same dataset are separated with a comma (,). For example: if we want to only output fields 1, 3, and 5 from " 
       << "the first dataset (indicated with param -i), and output fields 1, 2, and 9 from the second dataset (indicated with param -j) "
       << " then we can provide an option such as: --fields 1,3,5:1,2,9 " << endl;
+  cerr << TAB << "-m, --mem-limit" << TAB << "Memory budget in MB. The larger dataset is joined in batches that fit in what the "
+      << "cached dataset leaves of the budget. By default batches have " << OBJECT_LIMIT << " objects." << endl;
+  cerr << TAB << "-x, --index"    << TAB << "The cached dataset prepared by skewprep (with the same -j and the fields after the colon of "
+      << "--fields), used instead of parsing and indexing " << cacheFile << ". The file is mapped in memory read only." << endl;
 }
 
 // main body of the engine
@@ -0,0 +1,98 @@
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+
+#include <cstdlib>
+#include <stdint.h>
+#include <cstring>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/* Temporary file holding the objects of one set of a tile that does not
+ * fit in memory. An object is written as its MBR (4 doubles), then its
+ * geometry (WKT or WKB) and its output row, each after its length. The
+ * file is created in $TMPDIR (/tmp by default), read back sequentially
+ * from a position saved with tell(), and removed by close() or the
+ * destructor. */
+class SpillFile
+{
+  public:
+    SpillFile() : count(0) {}
+    ~SpillFile() { close(); }
+
+    bool open()
+    {
+      const char * dir = getenv("TMPDIR");
+      std::string name = std::string(dir != NULL && *dir != '\0' ? dir : "/tmp") + "/resque-spill-XXXXXX";
+      std::vector<char> buf(name.begin(), name.end());
+      buf.push_back('\0');
+      int fd = mkstemp(&buf[0]);
+      if (fd < 0)
+        return false;
+      ::close(fd);
+      path = &buf[0];
+      file.open(path.c_str(), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+      count = 0;
+      return file.good();
+    }
+
+    bool isOpen() const { return !path.empty(); }
+
+    // number of objects written
+    size_t size() const { return count; }
+
+    bool append(const double * mbr, const char * shape, uint32_t shape_len, const char * row)
+    {
+      uint32_t row_len = strlen(row);
+      file.write(reinterpret_cast<const char*>(mbr), 4 * sizeof(double));
+      file.write(reinterpret_cast<const char*>(&shape_len), sizeof(shape_len));
+      file.write(shape, shape_len);
+      file.write(reinterpret_cast<const char*>(&row_len), sizeof(row_len));
+      file.write(row, row_len);
+      count++;
+      return file.good();
+    }
+
+    std::streampos tell() { return file.tellg(); }
+
+    // continues reading at pos, written data is flushed first
+    void seek(std::streampos pos)
+    {
+      file.flush();
+      file.clear();
+      file.seekg(pos);
+    }
+
+    bool next(double * mbr, std::string & shape, std::string & row)
+    {
+      return file.read(reinterpret_cast<char*>(mbr), 4 * sizeof(double))
+          && readBytes(shape) && readBytes(row);
+    }
+
+    void close()
+    {
+      if (path.empty())
+        return;
+      file.close();
+      unlink(path.c_str());
+      path.clear();
+      count = 0;
+    }
+
+  private:
+    bool readBytes(std::string & data)
+    {
+      uint32_t len = 0;
+      if (!file.read(reinterpret_cast<char*>(&len), sizeof(len)))
+        return false;
+      data.resize(len);
+      return len == 0 || file.read(&data[0], len);
+    }
+
+    std::fstream file;
+    std::string path;
+    size_t count;
+};
+
+#endif
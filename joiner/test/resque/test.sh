@@ -0,0 +1,69 @@
+#!/usr/bin/env bash
+# Regression test for the symmetric self-join of resque: --symmetric both
+# must report the same pairs as the default evaluation, and --symmetric
+# once must report each of those pairs in exactly one orientation. The
+# tile is also refined by several threads (--tile-threads), which must
+# give the sequential output unchanged, in the same order. The semi join
+# must report the stores with a pair, the anti join the others.
+
+if [ -e ../../resque ];
+then 
+  cp ../../resque ./
+else
+  echo "missing resque exe in current directory."
+  exit 1; 
+fi
+
+# one tile, all stores in set 1: tileid, joinid, line number, store record
+awk 'BEGIN {FS = OFS = "\t"} {print 1, 1, NR, $0}' ../../../data/atl.stores.tsv > selfjoin.input.tsv
+
+rc=0
+check() {
+  if [ "$2" -ne 0 ]; then
+    echo "FAILED: $1"
+    rc=1
+  fi
+}
+
+for pred in "st_intersects" "st_touches" "st_dwithin -d 0.01"
+do
+  # geometry is the first field of a store, output: store id TAB store id
+  ./resque -p ${pred} -i 1 -f 2 < selfjoin.input.tsv 2>/dev/null | sort > default.out.tsv
+  check "${pred} default run" ${PIPESTATUS[0]}
+  ./resque -p ${pred} -i 1 -f 2 < selfjoin.input.tsv 2>/dev/null > sequential.out.tsv
+  ./resque -p ${pred} -i 1 -f 2 --tile-threads 4 --split-threshold 10 < selfjoin.input.tsv 2>/dev/null > split.out.tsv
+  check "${pred} tile threads run" $?
+  ./resque -p ${pred} -i 1 -f 2 --symmetric both < selfjoin.input.tsv 2>/dev/null | sort > both.out.tsv
+  check "${pred} symmetric both run" ${PIPESTATUS[0]}
+  ./resque -p ${pred} -i 1 -f 2 --symmetric once < selfjoin.input.tsv 2>/dev/null | sort > once.out.tsv
+  check "${pred} symmetric once run" ${PIPESTATUS[0]}
+  ./resque -p ${pred} -i 1 -f 2 --mode semi < selfjoin.input.tsv 2>/dev/null | sort > semi.out.tsv
+  check "${pred} semi join run" ${PIPESTATUS[0]}
+  ./resque -p ${pred} -i 1 -f 2 --mode anti < selfjoin.input.tsv 2>/dev/null | awk -F '\t' '$2 == 0 {print $1}' | sort > anti.out.tsv
+  check "${pred} anti join run" ${PIPESTATUS[0]}
+
+  cmp -s default.out.tsv both.out.tsv
+  check "${pred} symmetric both differs from default" $?
+
+  cmp -s sequential.out.tsv split.out.tsv
+  check "${pred} tile threads differ from sequential" $?
+
+  awk 'BEGIN {FS = OFS = "\t"} {print $1, $2; print $2, $1}' once.out.tsv | sort | cmp -s - default.out.tsv
+  check "${pred} symmetric once differs from default" $?
+
+  cut -f 1 default.out.tsv | uniq | cmp -s - semi.out.tsv
+  check "${pred} semi join differs from default" $?
+
+  awk 'BEGIN {FS = "\t"} {print $2}' ../../../data/atl.stores.tsv | sort | comm -23 - semi.out.tsv | cmp -s - anti.out.tsv
+  check "${pred} anti join differs from default" $?
+
+  echo "${pred}: $(wc -l < default.out.tsv) pairs"
+done
+
+if [ $rc -eq 0 ];then
+  echo -e "\n\nsymmetric self-join test has finished successfully."
+fi
+
+rm -f selfjoin.input.tsv default.out.tsv both.out.tsv once.out.tsv sequential.out.tsv split.out.tsv semi.out.tsv anti.out.tsv resque
+
+exit $rc ;
@@ -15,6 +15,17 @@ cat tweet.dump.tsv | ./skewresque --p st_within -i 2 -j 1 -d 1 -f 1,2:5,6 > skew
 cat tweet.dump.tsv | ./skewresque --p st_within -i 2 -j 1 -d 1 > skew.out.tsv
 
 rc=$?
+
+# the cached dataset prepared by skewprep must give the same pairs
+if [ $rc -eq 0 ] && [ -e ../../skewprep ];
+then
+  cp ../../skewprep ./
+  ./skewprep -j 1 -o hgskewinput.idx
+  cat tweet.dump.tsv | ./skewresque --p st_within -i 2 -j 1 -d 1 -x hgskewinput.idx | sort > prepared.out.tsv
+  sort skew.out.tsv | cmp -s - prepared.out.tsv
+  rc=$?
+  rm -f skewprep hgskewinput.idx prepared.out.tsv
+fi
 if [ $rc -eq 0 ];then
   echo -e "\n\njoin task has finished successfully."
 else
@@ -0,0 +1,109 @@
+#ifndef TILEARENA_H
+#define TILEARENA_H
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <new>
+
+/* Region allocator for the data of one tile. Memory is handed out from
+ * large blocks and released all at once by reset(), which keeps the
+ * blocks for the next tile. Individual allocations are never freed.
+ * An arena is used by one thread at a time. */
+class TileArena
+{
+  public:
+    TileArena(size_t block_size = 1 << 20) : block_size(block_size), current(0), used(0) {}
+
+    ~TileArena()
+    {
+      reset();
+      for (size_t k = 0; k < blocks.size(); k++)
+        free(blocks[k]);
+    }
+
+    void * allocate(size_t bytes)
+    {
+      // keep every allocation aligned for doubles and pointers
+      bytes = (bytes + ALIGN - 1) & ~(ALIGN - 1);
+      if (bytes > block_size / 4) {
+        // oversized requests get their own buffer, dropped by reset()
+        void * p = malloc(bytes);
+        if (p == NULL)
+          throw std::bad_alloc();
+        large.push_back(p);
+        return p;
+      }
+      if (current < blocks.size() && used + bytes > block_size) {
+        current++;
+        used = 0;
+      }
+      if (current == blocks.size()) {
+        void * p = malloc(block_size);
+        if (p == NULL)
+          throw std::bad_alloc();
+        blocks.push_back(static_cast<char*>(p));
+      }
+      void * p = blocks[current] + used;
+      used += bytes;
+      return p;
+    }
+
+    template <typename T>
+    T * allocate(size_t count)
+    {
+      return static_cast<T*>(allocate(count * sizeof(T)));
+    }
+
+    // NUL terminated copy of len bytes
+    char * copy(const char * s, size_t len)
+    {
+      char * p = static_cast<char*>(allocate(len + 1));
+      memcpy(p, s, len);
+      p[len] = '\0';
+      return p;
+    }
+
+    void reset()
+    {
+      for (size_t k = 0; k < large.size(); k++)
+        free(large[k]);
+      large.clear();
+      current = 0;
+      used = 0;
+    }
+
+  private:
+    static const size_t ALIGN = 16;
+
+    size_t block_size;
+    size_t current;
+    size_t used;
+    std::vector<char*> blocks;
+    std::vector<void*> large;
+};
+
+/* STL allocator on top of a TileArena, for containers that live only
+ * as long as the tile. deallocate() is a no-op. */
+template <typename T>
+class ArenaAllocator
+{
+  public:
+    typedef T value_type;
+
+    ArenaAllocator(TileArena & arena) : arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> & other) : arena(other.arena) {}
+
+    T * allocate(size_t n) { return arena->allocate<T>(n); }
+    void deallocate(T *, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> & other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> & other) const { return arena != other.arena; }
+
+    TileArena * arena;
+};
+
+#endif
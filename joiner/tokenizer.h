@@ -1,5 +1,6 @@
 #include <string>
 #include <vector>
+#include <cstring>
 
 using namespace std;
 
@@ -130,3 +131,49 @@ void tokenize ( const string& str, vector<string>& result,
     }
 }
 
+
+/* A field of a line as a pointer into the line and a length, nothing is
+ * copied. The line must outlive its fields. */
+struct field_t
+{
+    const char * ptr;
+    size_t len;
+
+    string str() const { return string(ptr, len); }
+    bool empty() const { return len == 0; }
+};
+
+/* Fast alternative to tokenize() for tab separated records: splits the
+ * line at every occurrence of delimiter (found with memchr) and keeps
+ * blank fields, like tokenize(line, result, TAB, true). Quotes are not
+ * interpreted. Callers materialize only the fields they need with str().
+ * Returns the number of fields, 0 for an empty line. */
+inline size_t split ( const char * line, size_t len, vector<field_t>& result,
+	const char delimiter = '\t' )
+{
+    result.clear();
+    if (len == 0)
+	return 0;
+
+    const char * end = line + len;
+    const char * pos = line;
+    const char * next = NULL;
+    field_t field;
+    while ( (next = static_cast<const char*>(memchr(pos, delimiter, end - pos))) != NULL )
+    {
+	field.ptr = pos;
+	field.len = next - pos;
+	result.push_back(field);
+	pos = next + 1;
+    }
+    field.ptr = pos;
+    field.len = end - pos;
+    result.push_back(field);
+    return result.size();
+}
+
+inline size_t split ( const string& line, vector<field_t>& result,
+	const char delimiter = '\t' )
+{
+    return split(line.data(), line.size(), result, delimiter);
+}
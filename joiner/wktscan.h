@@ -0,0 +1,66 @@
+#ifndef WKTSCAN_H
+#define WKTSCAN_H
+
+#include <cstdlib>
+#include <cctype>
+
+/* Computes the MBR of a WKT geometry straight from its coordinate text,
+ * without building the geometry. Geometry type names and EMPTY markers
+ * are skipped, the first two ordinates of every coordinate are taken
+ * as x and y. Numbers are read with strtod like in the GEOS WKTReader,
+ * so the MBR is identical to the envelope of the parsed geometry.
+ * The text must be followed by a character that cannot continue a
+ * number (a TAB or the end of the line).
+ * Returns 1 on success, 0 for an empty geometry and -1 when the
+ * coordinate text is not well formed. */
+inline int scanEnvelope(const char * wkt, size_t len,
+    double & min_x, double & min_y, double & max_x, double & max_y)
+{
+  const char * pos = wkt;
+  const char * end = wkt + len;
+  char * next = NULL;
+  bool found = false;
+  double x, y;
+
+  while (pos < end) {
+    char ch = *pos;
+    if (isalpha(ch) || isspace(ch) || ch == '(' || ch == ')' || ch == ',') {
+      pos++;
+      continue;
+    }
+
+    // a coordinate: x and y, then optional z and m ordinates
+    x = strtod(pos, &next);
+    if (next == pos)
+      return -1;
+    pos = next;
+    y = strtod(pos, &next);
+    if (next == pos || next > end)
+      return -1;
+    pos = next;
+    while (pos < end && *pos != ',' && *pos != ')') {
+      if (isspace(*pos)) {
+        pos++;
+        continue;
+      }
+      strtod(pos, &next);
+      if (next == pos)
+        return -1;
+      pos = next;
+    }
+
+    if (!found) {
+      min_x = max_x = x;
+      min_y = max_y = y;
+      found = true;
+    } else {
+      if (x < min_x) min_x = x;
+      if (x > max_x) max_x = x;
+      if (y < min_y) min_y = y;
+      if (y > max_y) max_y = y;
+    }
+  }
+  return found ? 1 : 0;
+}
+
+#endif
@@ -8,7 +8,8 @@ usage(){
   -i MIN_X, --min_x=MIN_X \t The smallest x-coordinate of the query window \n \
   -j MIN_Y, --min_y=MIN_Y \t The smallest y-coordinate of the query window \n \
   -k MAX_X, --max_x=MAX_X \t The largest x-coordinate of the query window \n \
-  -l MAX_Y, --max_y=MAX_Y \t The largest y-coordinate of the query window. \
+  -l MAX_Y, --max_y=MAX_Y \t The largest y-coordinate of the query window. \n \
+  -w WINDOW_FILE, --windows=WINDOW_FILE \t OPTIONAL - A local file of query windows answered by one scan, instead of -i -j -k -l: one window per line, id TAB min_x TAB min_y TAB max_x TAB max_y, or id TAB WKT geometry. Each result record is followed by the comma separated ids of its windows. \
 "
  # -i OBJECT_ID, --obj_id=OBJECT_ID \t The field (position) of the object ID \n \
   exit 1
@@ -17,6 +18,7 @@ usage(){
 # Default empty values
 datapath=""
 destination=""
+windows=""
 
 
 while : 
@@ -74,6 +76,14 @@ do
           max_y=${1#*=}
           shift
           ;;
+        -w | --windows)
+          windows=$2
+          shift 2
+	  ;;
+        --windows=*)
+          windows=${1#*=}
+          shift
+          ;;
         --)
           shift
           break
@@ -100,8 +110,9 @@ export LD_LIBRARY_PATH=${LD_CONFIG_PATH}
 PARTITION_FILE=partfile.idx
 
 PATH_RETRIEVER=../containment/getInputPath.py
+PLANNER=../joiner/rangeplanner
 
-if ! [ "${min_x}" ] && ! [ "${min_y}" ] && ! [ "${max_x}" ] && ! [ "${max_y}" ]; then
+if ! [ "${windows}" ] && ! [ "${min_x}" ] && ! [ "${min_y}" ] && ! [ "${max_x}" ] && ! [ "${max_y}" ]; then
      echo "ERROR: Missing query window dimensions. See --help"
      exit 1
 fi
@@ -129,7 +140,28 @@ hdfs dfs -get ${datapath}/${PARTITION_FILE} ${TMP_PARTITION_FILE}
 ### Need a check for valid data + cfg file in the HDFS path
 ###
 
-hdfs dfs -cat ${datapath}/${PARTITION_FILE} | ../containment/getInputPath.py ${min_x} ${min_y} ${max_x} ${max_y} ${datapath}/data/ > ${TMP_INPUT_PATH}
+if [ "${windows}" ]; then
+   # the partitions intersecting any window, all of them for a geometry window
+   TMP_PARTITIONS=$(mktemp)
+   hdfs dfs -cat ${datapath}/${PARTITION_FILE} > ${TMP_PARTITIONS}
+   while IFS=$'\t' read -r wid wminx wminy wmaxx wmaxy
+   do
+     if [ "${wmaxy}" ]; then
+       ../containment/getInputPath.py ${wminx} ${wminy} ${wmaxx} ${wmaxy} ${datapath}/data/ < ${TMP_PARTITIONS}
+     else
+       cut -f 1 ${TMP_PARTITIONS} | sed "s#^#${datapath}/data/#"
+     fi
+   done < ${windows} | sort -u > ${TMP_INPUT_PATH}
+   rm ${TMP_PARTITIONS}
+else
+   # the partitions intersecting the window, and those it covers (not tested by the mapper)
+   TMP_PARTITIONS=$(mktemp)
+   TMP_PLAN=$(mktemp)
+   hdfs dfs -cat ${datapath}/${PARTITION_FILE} > ${TMP_PARTITIONS}
+   ${PLANNER} ${TMP_PARTITIONS} ${min_x} ${min_y} ${max_x} ${max_y} > ${TMP_PLAN}
+   cut -f 1 ${TMP_PLAN} | sed "s#^#${datapath}/data/#" > ${TMP_INPUT_PATH}
+   rm ${TMP_PARTITIONS}
+fi
 #../containment/getInputPath.py ${min_x} ${min_y} ${max_x} ${max_y} ${datapath}/data/ < ${TMP_PARTITION_FILE} > ${TMP_INPUT_PATH}
 
 rm ${TMP_PARTITION_FILE}
@@ -154,6 +186,17 @@ MAPPER_1=containment
 MAPPER_1_PATH=../joiner/containment
 OUTPUT_1=${destination}
 
+# the window arguments of the mapper, the window (or plan) file is shipped with the job
+if [ "${windows}" ]; then
+   windowargs="--windows $(basename ${windows}) ${geomid}"
+   localwindowargs="--windows ${windows} ${geomid}"
+   windowfilearg="-file ${windows}"
+else
+   windowargs="--plan $(basename ${TMP_PLAN}) ${min_x} ${min_y} ${max_x} ${max_y} ${geomid}"
+   localwindowargs="--plan ${TMP_PLAN} ${min_x} ${min_y} ${max_x} ${max_y} ${geomid}"
+   windowfilearg="-file ${TMP_PLAN}"
+fi
+
 # Removing the destination directory
 hdfs dfs -rm -f -r ${destination}
 
@@ -165,20 +208,21 @@ if [[ ${num_input_files} == 1 ]] ; then
    file_name=`(cat "${TMP_INPUT_PATH}")`
 
    hdfs dfs -mkdir -p ${destination}
-   hdfs dfs -cat ${file_name}/* |  ${MAPPER_1_PATH} ${min_x} ${min_y} ${max_x} ${max_y} ${geomid} > ${TMP_INPUT_PATH}
+   hdfs dfs -cat ${file_name}/* |  ${MAPPER_1_PATH} ${localwindowargs} > ${TMP_INPUT_PATH}
    hdfs dfs -put ${TMP_INPUT_PATH} ${OUTPUT_1}/part-00000
 else
    echo "Invoking MapReduce."
-   echo "Querying: $min_x $min_y $max_x $max_y"
+   echo "Querying: ${windowargs}"
    input_path=" "
    while read -r line
       do
         input_path=${input_path}"-input "${line}" "
    done < ${TMP_INPUT_PATH}
    echo "Input path: "${input_path}
-   hadoop jar ${HJAR} ${input_path} -output ${destination} -file ${MAPPER_1_PATH} -mapper "${MAPPER_1} ${min_x} ${min_y} ${max_x} ${max_y} ${geomid}" -reducer None --cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks 0
+   hadoop jar ${HJAR} ${input_path} -output ${destination} -file ${MAPPER_1_PATH} ${windowfilearg} -mapper "${MAPPER_1} ${windowargs}" -reducer None --cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks 0
 fi
 
+rm -f ${TMP_PLAN}
 rm ${TMP_INPUT_PATH}
 echo "Done. Results are available at ${OUTPUT_1}"
 
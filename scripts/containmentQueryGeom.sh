@@ -85,8 +85,10 @@ PARTITION_FILE=partfile.idx
 
 filename=$(basename ${filegeom})
 
-PATH_RETRIEVER=../containment/getInputPath.py
+PLANNER=../joiner/rangeplanner
 TMP_INPUT_PATH=$(mktemp)
+TMP_PARTITION_FILE=$(mktemp)
+TMP_PLAN=$(mktemp)
 echo "Creating "${TMP_INPUT_PATH}
 
 
@@ -97,7 +99,10 @@ echo ${min_y}
 echo ${max_x}
 echo ${max_y}
 
-hdfs dfs -cat ${datapath}/${PARTITION_FILE} | ${PATH_RETRIEVER} ${min_x} ${min_y} ${max_x} ${max_y} ${datapath}/data/  > ${TMP_INPUT_PATH}
+# the partitions intersecting the query geometry, and those it covers (not tested by the mapper)
+hdfs dfs -cat ${datapath}/${PARTITION_FILE} > ${TMP_PARTITION_FILE}
+${PLANNER} ${TMP_PARTITION_FILE} ${min_x} ${min_y} ${max_x} ${max_y} ${filegeom} > ${TMP_PLAN}
+cut -f 1 ${TMP_PLAN} | sed "s#^#${datapath}/data/#" > ${TMP_INPUT_PATH}
 
 num_input_files=`(wc -l "${TMP_INPUT_PATH}" | cut -d" " -f1)`
 
@@ -138,7 +143,7 @@ if [[ ${num_input_files} == 1 ]] ; then
    tmp_file_name=`(cat "${TMP_INPUT_PATH}")`
 
    hdfs dfs -mkdir -p ${destination}
-   hdfs dfs -cat ${tmp_file_name}/* |  ${MAPPER_1_PATH} ${min_x} ${min_y} ${max_x} ${max_y} ${geomid} ${filegeom} > ${TMP_INPUT_PATH}
+   hdfs dfs -cat ${tmp_file_name}/* |  ${MAPPER_1_PATH} --plan ${TMP_PLAN} ${min_x} ${min_y} ${max_x} ${max_y} ${geomid} ${filegeom} > ${TMP_INPUT_PATH}
    hdfs dfs -put ${TMP_INPUT_PATH} ${OUTPUT_1}/part-00000
 else
    echo "Invoking MapReduce."
@@ -148,10 +153,11 @@ else
         input_path=${input_path}"-input "${line}" "
    done < ${TMP_INPUT_PATH}
    echo "Input path: "${input_path}
-   hadoop jar ${HJAR} ${input_path} -output ${destination} -file ${MAPPER_1_PATH} -file ${filegeom} -mapper "${MAPPER_1} ${min_x} ${min_y} ${max_x} ${max_y} ${geomid} ${filename}" -reducer None --cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks 0
+   hadoop jar ${HJAR} ${input_path} -output ${destination} -file ${MAPPER_1_PATH} -file ${filegeom} -file ${TMP_PLAN} -mapper "${MAPPER_1} --plan $(basename ${TMP_PLAN}) ${min_x} ${min_y} ${max_x} ${max_y} ${geomid} ${filename}" -reducer None --cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks 0
 fi
 
 rm ${TMP_PARTITION_FILE}
+rm ${TMP_PLAN}
 rm ${TMP_INPUT_PATH}
 echo "Done. Results are available at ${OUTPUT_1}"
 
@@ -13,7 +13,10 @@ usage(){
   -s TRUE_OR_FALSE, --statistics=TRUE_OR_FALSE \t Appending additional spatial join statistics to joined pairs: [true | false]. The default is false. \n \
   -t TRUE_OR_FALSE, --tileid=TRUE_OR_FALSE \t Appending (keeping) the tile id as the last field appended to the output [true | false]. The default is false. \n \
   -m PARTITION_METHOD, --method=PARTITION_METHOD \t OPTIONAL - The partitioning method. The default method is fixed grid partitioning. [ fg | bsp ] \n \
-  -r SAMPLING_RATIO, --ratio=SAMPLING_RATIO \t OPTIONAL - The sampling ratio for partitioning the data. Default value is 1.0."
+  -r SAMPLING_RATIO, --ratio=SAMPLING_RATIO \t OPTIONAL - The sampling ratio for partitioning the data. Default value is 1.0. \n \
+  -w TRUE_OR_FALSE, --binary=TRUE_OR_FALSE \t OPTIONAL - Shuffle binary tile records (MBR, WKB geometry and the other fields) instead of text lines: [true | false]. The geometry field is left empty in the output. The default is false. \n \
+  -o OUTPUT_MODE, --output=OUTPUT_MODE \t OPTIONAL - What the join reports: the joined pairs, only the number of pairs, or the number of pairs of every object of data set 1 [ pairs | count | count-per-left ]. The default is pairs. \n \
+  -e JOIN_MODE, --mode=JOIN_MODE \t OPTIONAL - join reports the matching pairs, semi the objects of data set 1 with a match, anti those without a match [ join | semi | anti ]. The default is join."
  # -i OBJECT_ID, --obj_id=OBJECT_ID \t The field (position) of the object ID \n \
   exit 1
 }
@@ -34,10 +37,12 @@ sampleratio=1
 method="fg"
 statistics="false"
 tileid="false"
+binary="false"
+output="pairs"
+mode="join"
 numreducers=""
 qdistance=0
 fields=""
-deduparg="uniq"
 
 while : 
 do
@@ -126,6 +131,30 @@ do
           method=${1#*=}
           shift
           ;;
+        -w | --binary)
+          binary=$2
+          shift 2
+          ;;
+        --binary=*)
+          binary=${1#*=}
+          shift
+          ;;
+        -o | --output)
+          output=$2
+          shift 2
+          ;;
+        --output=*)
+          output=${1#*=}
+          shift
+          ;;
+        -e | --mode)
+          mode=$2
+          shift 2
+          ;;
+        --mode=*)
+          mode=${1#*=}
+          shift
+          ;;
         -f | --fields)
           fields=$2
           shift 2
@@ -180,6 +209,21 @@ if ! [[ ${numreducers} -ge 1 ]]; then
   exit 1
 fi
 
+if [ "${output}" != "pairs" ] && [ "${output}" != "count" ] && [ "${output}" != "count-per-left" ]; then
+   echo "ERROR: Invalid output mode. See --help" >&2
+   exit 1
+fi
+
+if [ "${mode}" != "join" ] && [ "${mode}" != "semi" ] && [ "${mode}" != "anti" ]; then
+   echo "ERROR: Invalid join mode. See --help" >&2
+   exit 1
+fi
+
+if [ "${mode}" != "join" ] && [ "${output}" != "pairs" ]; then
+   echo "ERROR: The semi and anti joins report objects, not counts. See --help" >&2
+   exit 1
+fi
+
 if ! [ "${method}" == "fg" ] && ! [ "${method}" == "bsp" ] ; then
    echo "Invalid partitioning method"
    exit 1
@@ -192,7 +236,45 @@ fi
 tileidarg=""
 if [ "${tileid}" ] ; then
    tileidarg="-t ${tileid}"
-   deduparg="uniq2"
+fi
+
+# the results of the tiles are aggregated by a second job: counts are
+# added up, objects of data set 1 are reported once
+outputarg=""
+aggregate="false"
+aggmapper="cat -"
+aggcombiner="hgdeduplicater.py sum"
+aggreducer="hgdeduplicater.py sum"
+aggreducers=${numreducers}
+if [ "${output}" != "pairs" ] ; then
+   outputarg="-o ${output}"
+   aggregate="true"
+fi
+if [ "${output}" == "count" ] ; then
+   # drop the tile id to get one total
+   aggmapper="cut -f 2"
+   aggreducers=1
+fi
+if [ "${mode}" == "semi" ] ; then
+   outputarg="-e semi"
+   aggregate="true"
+   aggcombiner="hgdeduplicater.py uniq"
+   aggreducer="hgdeduplicater.py uniq"
+fi
+if [ "${mode}" == "anti" ] ; then
+   outputarg="-e anti"
+   aggregate="true"
+   aggreducer="hgdeduplicater.py anti"
+fi
+
+# binary tile records travel as Hadoop streaming rawbytes frames
+binarymaparg=""
+binaryjobarg=""
+binaryarg=""
+if [ "${binary}" == "true" ] ; then
+   binarymaparg="--binary "
+   binaryjobarg="-D stream.map.output=rawbytes -D stream.reduce.input=rawbytes"
+   binaryarg="-b true"
 fi
 
 # Creating the path with the HDFS prefix
@@ -309,7 +391,10 @@ hdfs dfs -put ${PARTITION_FILE_DENORM} ${OUTPUT_1}/${SATO_INDEX_FILE_NAME}
 
 INPUT_2A=${prefixpath1}'/data/*/*'
 INPUT_2B=${prefixpath2}'/data/*/*'
-OUTPUT_2=${destination}_tmp2
+OUTPUT_2=${destination}
+if [ "${aggregate}" == "true" ] ; then
+   OUTPUT_2=${destination}_tiles
+fi
 MAPPER_2=partitionMapperJoin
 MAPPER_2_PATH=../tiler/partitionMapperJoin
 REDUCER_2=resque
@@ -320,35 +405,32 @@ hdfs dfs -rm -f -r ${OUTPUT_2}
 
 predicate="st_"${predicate}
 
-echo "${MAPPER_2} ${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}"
-echo "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg}"
+# The reducer reads the partition file to report each pair only in one tile,
+# so the join output needs no separate deduplication step
+echo "${MAPPER_2} ${binarymaparg}${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}"
+echo "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} -x ${SATO_INDEX_FILE_NAME} ${fieldsarg} ${tileidarg} ${binaryarg} ${outputarg}"
 
 #Perform spatial join
-hadoop jar ${HJAR} -input ${INPUT_2A} -input ${INPUT_2B} -output ${OUTPUT_2} -file ${MAPPER_2_PATH} -file ${REDUCER_2_PATH} -file ${SATO_INDEX_FILE_NAME}  -mapper "${MAPPER_2} ${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}" -reducer "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg}" -cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks ${numreducers}
+hadoop jar ${HJAR} ${binaryjobarg} -input ${INPUT_2A} -input ${INPUT_2B} -output ${OUTPUT_2} -file ${MAPPER_2_PATH} -file ${REDUCER_2_PATH} -file ${SATO_INDEX_FILE_NAME}  -mapper "${MAPPER_2} ${binarymaparg}${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}" -reducer "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} -x ${SATO_INDEX_FILE_NAME} ${fieldsarg} ${tileidarg} ${binaryarg} ${outputarg}" -cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks ${numreducers}
 
 if [  $? -ne 0 ]; then
    echo "Spatial computation has failed!"
    exit 1
 fi
 
-rm -f ${SATO_INDEX_FILE_NAME}
-rm -f ${PARTITION_FILE_DENORM}
-
-INPUT_3=${OUTPUT_2}
-OUTPUT_3=${destination}
-REDUCER_3=hgdeduplicater.py
-REDUCER_3_PATH=../joiner/hgdeduplicater.py
-hdfs dfs -rm -r ${OUTPUT_3}
-echo -e "Deduplication step" 
-
-hadoop jar ${HJAR} -file ${REDUCER_3_PATH} -mapper 'cat -' -reducer "${REDUCER_3} ${deduparg}" -input ${INPUT_3} -output ${OUTPUT_3} -numReduceTasks ${numreducers} -jobconf mapred.task.timeout=360000000
+# Aggregate the results of all tiles
+if [ "${aggregate}" == "true" ] ; then
+   hdfs dfs -rm -f -r ${destination}
+   hadoop jar ${HJAR} -input ${OUTPUT_2} -output ${destination} -file ../joiner/hgdeduplicater.py -mapper "${aggmapper}" -combiner "${aggcombiner}" -reducer "${aggreducer}" -numReduceTasks ${aggreducers}
 
-succ=$?
-
-if [[ $succ != 0 ]] ; then
-    echo -e "\n\n deduplication stage has failed. \nPlease check the output result for debugging."
-    exit $succ
+   if [  $? -ne 0 ]; then
+      echo "Aggregating the tile results has failed!"
+      exit 1
+   fi
+   hdfs dfs -rm -f -r ${OUTPUT_2}
 fi
-hdfs dfs -rm -r -f ${OUTPUT_2}
 
-echo "Done. Results are available at ${OUTPUT_3}"
+rm -f ${SATO_INDEX_FILE_NAME}
+rm -f ${PARTITION_FILE_DENORM}
+
+echo "Done. Results are available at ${destination}"
@@ -13,7 +13,8 @@ usage(){
   -s TRUE_OR_FALSE, --statistics=TRUE_OR_FALSE \t Appending additional spatial join statistics to joined pairs: [true | false]. The default is false. \n \
   -t TRUE_OR_FALSE, --tileid=TRUE_OR_FALSE \t Appending (keeping) the tile id as the last field appended to the output [true | false]. The default is false. \n \
   -m PARTITION_METHOD, --method=PARTITION_METHOD \t OPTIONAL - The partitioning method. The default method is fixed grid partitioning. [ fg | bsp ] \n \
-  -r SAMPLING_RATIO, --ratio=SAMPLING_RATIO \t OPTIONAL - The sampling ratio for partitioning the data. Default value is 1.0."
+  -r SAMPLING_RATIO, --ratio=SAMPLING_RATIO \t OPTIONAL - The sampling ratio for partitioning the data. Default value is 1.0. \n \
+  -w TRUE_OR_FALSE, --binary=TRUE_OR_FALSE \t OPTIONAL - Shuffle binary tile records (MBR, WKB geometry and the other fields) instead of text lines: [true | false]. The geometry field is left empty in the output. The default is false."
  # -i OBJECT_ID, --obj_id=OBJECT_ID \t The field (position) of the object ID \n \
   exit 1
 }
@@ -34,6 +35,7 @@ sampleratio=1
 method="fg"
 statistics="false"
 tileid="false"
+binary="false"
 numreducers=""
 qdistance=0
 fields=""
@@ -126,6 +128,14 @@ do
           method=${1#*=}
           shift
           ;;
+        -w | --binary)
+          binary=$2
+          shift 2
+          ;;
+        --binary=*)
+          binary=${1#*=}
+          shift
+          ;;
         -f | --fields)
           fields=$2
           shift 2
@@ -195,6 +205,16 @@ if [ "${tileid}" ] ; then
    deduparg="uniq2"
 fi
 
+# binary tile records travel as Hadoop streaming rawbytes frames
+binarymaparg=""
+binaryjobarg=""
+binaryarg=""
+if [ "${binary}" == "true" ] ; then
+   binarymaparg="--binary "
+   binaryjobarg="-D stream.map.output=rawbytes -D stream.reduce.input=rawbytes"
+   binaryarg="-b true"
+fi
+
 # Creating the path with the HDFS prefix
 hdfs dfs -mkdir -p ${destination}
 
@@ -320,12 +340,12 @@ hdfs dfs -rm -f -r ${OUTPUT_2}
 
 predicate="st_"${predicate}
 
-echo "${MAPPER_2} ${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}"
-echo "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg}"
+echo "${MAPPER_2} ${binarymaparg}${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}"
+echo "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg} ${binaryarg}"
 
 #Perform spatial join
-#hadoop jar ${HJAR} -input ${INPUT_2A} -input ${INPUT_2B} -output ${OUTPUT_2} -file ${MAPPER_2_PATH} -file ${REDUCER_2_PATH} -file ${SATO_INDEX_FILE_NAME}  -mapper "${MAPPER_2} ${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}" -reducer "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg}" -cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks ${numreducers}
-hadoop jar ${HJAR} -input ${INPUT_2A} -input ${INPUT_2B} -output ${OUTPUT_2} -file ${MAPPER_2_PATH} -file ${REDUCER_2_PATH} -file ${SATO_INDEX_FILE_NAME}  -mapper "${MAPPER_2} ${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}" -reducer "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg}" -cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks 0
+#hadoop jar ${HJAR} ${binaryjobarg} -input ${INPUT_2A} -input ${INPUT_2B} -output ${OUTPUT_2} -file ${MAPPER_2_PATH} -file ${REDUCER_2_PATH} -file ${SATO_INDEX_FILE_NAME}  -mapper "${MAPPER_2} ${binarymaparg}${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}" -reducer "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg} ${binaryarg}" -cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks ${numreducers}
+hadoop jar ${HJAR} ${binaryjobarg} -input ${INPUT_2A} -input ${INPUT_2B} -output ${OUTPUT_2} -file ${MAPPER_2_PATH} -file ${REDUCER_2_PATH} -file ${SATO_INDEX_FILE_NAME}  -mapper "${MAPPER_2} ${binarymaparg}${geomid1} ${geomid2} ${SATO_INDEX_FILE_NAME} ${prefixpath1} ${prefixpath2}" -reducer "${REDUCER_2} -p ${predicate} -i ${geomid1} -j ${geomid2} -s ${statistics} -d ${qdistance} ${fieldsarg} ${tileidarg} ${binaryarg}" -cmdenv LD_LIBRARY_PATH=${LD_CONFIG_PATH} -numReduceTasks 0
 exit
 
 if [  $? -ne 0 ]; then
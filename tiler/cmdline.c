@@ -42,10 +42,12 @@ const char *gengetopt_args_info_help[] = {
   "  -y, --y-split=INT   Number of split in vertical direction",
   "  -g, --geom=INT      geometry field index",
   "  -u, --uid=INT       uid field index",
+  "  -t, --stream        Assign every object to its grid cells as it is read, \n                        without an index  (default=off)",
     0
 };
 
 typedef enum {ARG_NO
+  , ARG_FLAG
   , ARG_INT
   , ARG_DOUBLE
 } cmdline_parser_arg_type;
@@ -78,6 +80,7 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->y_split_given = 0 ;
   args_info->geom_given = 0 ;
   args_info->uid_given = 0 ;
+  args_info->stream_given = 0 ;
 }
 
 static
@@ -92,6 +95,7 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->y_split_orig = NULL;
   args_info->geom_orig = NULL;
   args_info->uid_orig = NULL;
+  args_info->stream_flag = 0;
   
 }
 
@@ -110,6 +114,7 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->y_split_help = gengetopt_args_info_help[7] ;
   args_info->geom_help = gengetopt_args_info_help[8] ;
   args_info->uid_help = gengetopt_args_info_help[9] ;
+  args_info->stream_help = gengetopt_args_info_help[10] ;
   
 }
 
@@ -248,6 +253,8 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "geom", args_info->geom_orig, 0);
   if (args_info->uid_given)
     write_into_file(outfile, "uid", args_info->uid_orig, 0);
+  if (args_info->stream_given)
+    write_into_file(outfile, "stream", 0, 0 );
   
 
   i = EXIT_SUCCESS;
@@ -483,6 +490,9 @@ int update_arg(void *field, char **orig_field,
     val = possible_values[found];
 
   switch(arg_type) {
+  case ARG_FLAG:
+    *((int *)field) = !*((int *)field);
+    break;
   case ARG_INT:
     if (val) *((int *)field) = strtol (val, &stop_char, 0);
     break;
@@ -509,6 +519,7 @@ int update_arg(void *field, char **orig_field,
   /* store the original value */
   switch(arg_type) {
   case ARG_NO:
+  case ARG_FLAG:
     break;
   default:
     if (value && orig_field) {
@@ -573,10 +584,11 @@ cmdline_parser_internal (
         { "y-split",	1, NULL, 'y' },
         { "geom",	1, NULL, 'g' },
         { "uid",	1, NULL, 'u' },
+        { "stream",	0, NULL, 't' },
         { 0,  0, 0, 0 }
       };
 
-      c = getopt_long (argc, argv, "hVw:e:s:n:x:y:g:u:", long_options, &option_index);
+      c = getopt_long (argc, argv, "hVw:e:s:n:x:y:g:u:t", long_options, &option_index);
 
       if (c == -1) break;	/* Exit from `while (1)' loop.  */
 
@@ -688,6 +700,16 @@ cmdline_parser_internal (
             goto failure;
         
           break;
+        case 't':	/* Assign every object to its grid cells as it is read, without an index.  */
+        
+        
+          if (update_arg((void *)&(args_info->stream_flag), 0, &(args_info->stream_given),
+              &(local_args_info.stream_given), optarg, 0, 0, ARG_FLAG,
+              check_ambiguity, override, 1, 0, "stream", 't',
+              additional_error))
+            goto failure;
+        
+          break;
 
         case 0:	/* Long option with no short option */
         case '?':	/* Invalid option.  */
@@ -63,6 +63,8 @@ struct gengetopt_args_info
   int uid_arg;	/**< @brief uid field index.  */
   char * uid_orig;	/**< @brief uid field index original value given at command line.  */
   const char *uid_help; /**< @brief uid field index help description.  */
+  int stream_flag;	/**< @brief Assign every object to its grid cells as it is read, without an index (default=off).  */
+  const char *stream_help; /**< @brief Assign every object to its grid cells as it is read, without an index help description.  */
   
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int version_given ;	/**< @brief Whether version was given.  */
@@ -74,6 +76,7 @@ struct gengetopt_args_info
   unsigned int y_split_given ;	/**< @brief Whether y-split was given.  */
   unsigned int geom_given ;	/**< @brief Whether geom was given.  */
   unsigned int uid_given ;	/**< @brief Whether uid was given.  */
+  unsigned int stream_given ;	/**< @brief Whether stream was given.  */
 
 } ;
 
@@ -32,12 +32,6 @@ void freeObjects() {
     delete storage;
 }
 
-vector<string> parse(string & line) {
-  vector<string> tokens ;
-  tokenize(line, tokens,TAB,true);
-  return tokens;
-}
-
 int main(int argc, char **argv) {
   double min_x;
   double max_x;
@@ -65,7 +59,7 @@ int main(int argc, char **argv) {
   // process input data 
   map<int,Geometry*> geom_polygons;
   string input_line;
-  vector<string> fields;
+  vector<field_t> fields;
   cerr << "Reading input from stdin..." <<endl; 
   id_type id ; 
   Geometry* geom; 
@@ -74,11 +68,11 @@ int main(int argc, char **argv) {
 
   long count = 1;
   while(cin && getline(cin, input_line) && !cin.eof()){
-    fields = parse(input_line);
-    //if (fields[ID_IDX].length() <1 )
+    split(input_line, fields);
+    //if (ID_IDX >= fields.size() || fields[ID_IDX].len <1 )
     //  continue ;  // skip lines which has empty id field 
-    // id = std::strtoul(fields[ID_IDX].c_str(), NULL, 0);
-    if (fields[GEOM_IDX].length() <2 )
+    // id = std::strtoul(fields[ID_IDX].ptr, NULL, 0);
+    if (GEOM_IDX >= fields.size() || fields[GEOM_IDX].len <2 )
     {
 #ifndef NDEBUG
       cerr << "skipping record [" << id <<"]"<< endl;
@@ -86,7 +80,7 @@ int main(int argc, char **argv) {
       continue ;  // skip lines which has empty geometry
     }
     // try {
-    geom = wkt_reader->read(fields[GEOM_IDX]);
+    geom = wkt_reader->read(fields[GEOM_IDX].str());
     env = geom->getEnvelopeInternal();
     if ( (double) rand() / (double) (RAND_MAX) < ratio) {
         cout << count++ << TAB  << env->getMinX() << TAB << env->getMinY() << TAB 
@@ -1,193 +1,36 @@
 #include "hadoopgis.h"
 #include "cmdline.h"
+#include "partitionlookup.h"
+#include "tilerecord.h"
+#include <geos/io/WKBWriter.h>
+#include <sstream>
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
 
 GeometryFactory *gf = NULL;
 WKTReader *wkt_reader = NULL;
-IStorageManager * storage = NULL;
-ISpatialIndex * spidx = NULL;
-map<id_type,string> id_tiles ;
 vector<id_type> hits ; 
 char * prefix;
 char * filename;
 
 int GEOM_IDX = -1;
 int JOIN_IDX = -1;
+// write binary tile records (tilerecord.h) instead of text lines
+bool binary = false;
 
-map<int,Geometry*> geom_tiles;
+PartitionLookup partitions;
 
 /* 
  * The program maps the input tsv data into corresponding partition 
  * (it adds the prefix partition id number at the beginning of the line)
  * */
 
-RTree::Data* parseInputPolygon(Geometry *p, id_type m_id) {
-    double low[2], high[2];
-    const Envelope * env = p->getEnvelopeInternal();
-    low [0] = env->getMinX();
-    low [1] = env->getMinY();
-
-    high [0] = env->getMaxX();
-    high [1] = env->getMaxY();
-
-    Region r(low, high, 2);
-
-    return new RTree::Data(0, 0 , r, m_id);// store a zero size null poiter.
-}
-
-
-class GEOSDataStream : public IDataStream
-{
-    public:
-	GEOSDataStream(map<int,Geometry*> * inputColl ) : m_pNext(0), len(0),m_id(0)
-    {
-	if (inputColl->empty())
-	    throw Tools::IllegalArgumentException("Input size is ZERO.");
-	shapes = inputColl;
-	len = inputColl->size();
-	iter = shapes->begin();
-	readNextEntry();
-    }
-	virtual ~GEOSDataStream()
-	{
-	    if (m_pNext != 0) delete m_pNext;
-	}
-
-	virtual IData* getNext()
-	{
-	    if (m_pNext == 0) return 0;
-
-	    RTree::Data* ret = m_pNext;
-	    m_pNext = 0;
-	    readNextEntry();
-	    return ret;
-	}
-
-	virtual bool hasNext()
-	{
-	    return (m_pNext != 0);
-	}
-
-	virtual uint32_t size()
-	{
-	    return len;
-	    //throw Tools::NotSupportedException("Operation not supported.");
-	}
-
-	virtual void rewind()
-	{
-	    if (m_pNext != 0)
-	    {
-		delete m_pNext;
-		m_pNext = 0;
-	    }
-
-	    m_id  = 0;
-	    iter = shapes->begin();
-	    readNextEntry();
-	}
-
-	void readNextEntry()
-	{
-	    if (iter != shapes->end())
-	    {
-		//std::cerr<< "readNextEntry m_id == " << m_id << std::endl;
-		m_id = iter->first;
-		m_pNext = parseInputPolygon(iter->second, m_id);
-		iter++;
-	    }
-	}
-
-	RTree::Data* m_pNext;
-	map<int,Geometry*> * shapes; 
-	map<int,Geometry*>::iterator iter; 
-
-	int len;
-	id_type m_id;
-};
-
-
-class MyVisitor : public IVisitor
-{
-    public:
-	void visitNode(const INode& n) {}
-	void visitData(std::string &s) {}
-
-	void visitData(const IData& d)
-	{
-	    hits.push_back(d.getIdentifier());
-	    //std::cout << d.getIdentifier()<< std::endl;
-	}
-
-	void visitData(std::vector<const IData*>& v) {}
-	void visitData(std::vector<uint32_t>& v){}
-};
-
-
-
+// the tiles intersecting the MBR of poly, in hits
 void doQuery(Geometry* poly) {
-    double low[2], high[2];
     const Envelope * env = poly->getEnvelopeInternal();
-
-    low [0] = env->getMinX();
-    low [1] = env->getMinY();
-
-    high [0] = env->getMaxX();
-    high [1] = env->getMaxY();
-
-   // cerr << low[0] << TAB << low[1] << TAB << high[0] << TAB << high[1] << endl;
-
-    Region r(low, high, 2);
-
-    // clear the result container 
-    hits.clear();
-
-    MyVisitor vis ; 
-    //spidx->containsWhatQuery(r, vis);
-    spidx->intersectsWithQuery(r, vis);
-
-}
-
-vector<string> parse(string & line) {
-    vector<string> tokens ;
-    tokenize(line, tokens,TAB,true);
-    return tokens;
-}
-
-void genTiles() {
-    vector<Geometry*> tiles;
-    string input_line2;
-    stringstream ss;
-    vector<string> fields;
-    double min_x, min_y, max_x, max_y;
-    id_type id;
-//    cerr << glominx << TAB << glominy << TAB << glomaxx << TAB << glomaxy << endl;
-
-    std::ifstream skewFile(filename);
-    while (std::getline(skewFile, input_line2)) {
-	fields = parse(input_line2);
-        min_x = std::stod(fields[1]);
-        min_y = std::stod(fields[2]);
-        max_x = std::stod(fields[3]);
-        max_y = std::stod(fields[4]);
-
-	ss << shapebegin << min_x << SPACE << min_y << COMMA
-	 << min_x << SPACE << max_y << COMMA
-	 << max_x << SPACE << max_y << COMMA
-	 << max_x << SPACE << min_y << COMMA
-	 << min_x << SPACE << min_y << shapeend;
-
-	// cerr << ss.str() << endl;
-        id = std::strtoul(fields[0].c_str(), NULL, 0);
-        geom_tiles[id]= wkt_reader->read(ss.str());
-        id_tiles[id] = id;
-
-	ss.str(string());
-
-        fields.clear();
-    }   
+    partitions.query(env->getMinX(), env->getMinY(), env->getMaxX(), env->getMaxY(), hits);
 }
 
 
@@ -195,8 +38,6 @@ void freeObjects() {
     // garbage collection 
     delete wkt_reader ;
     delete gf ; 
-    delete spidx;
-    delete storage;
 }
 
 void emitHits(Geometry* poly, string input_line) {
@@ -213,27 +54,55 @@ void emitHits(Geometry* poly, string input_line) {
 }
 
 
-bool buildIndex() {
-    // build spatial index on tile boundaries 
-    id_type  indexIdentifier;
-    GEOSDataStream stream(&geom_tiles);
-    storage = StorageManager::createNewMemoryStorageManager();
-    spidx   = RTree::createAndBulkLoadNewRTree(RTree::BLM_STR, stream, *storage, 
-	    FillFactor,
-	    IndexCapacity,
-	    LeafCapacity,
-	    2, 
-	    RTree::RV_RSTAR, indexIdentifier);
-
-    // Error checking 
-    return spidx->isIndexValid();
+/* Binary variant of emitHits(): one record per intersecting tile, with
+ * the MBR, the geometry as WKB and the record without its geometry field */
+void emitBinaryHits(Geometry* poly, const string & input_line, const field_t & geom_field) {
+   static WKBWriter wkb_writer;
+   static std::ostringstream wkb;
+   static string payload;
+   static string buffer;
+   char tile_id[32];
+   tile_record r;
+   const Envelope * env = poly->getEnvelopeInternal();
+
+   wkb.str(string());
+   wkb_writer.write(*poly, wkb);
+   string shape = wkb.str();
+   size_t geom_pos = geom_field.ptr - input_line.data();
+   payload.assign(input_line, 0, geom_pos);
+   payload.append(input_line, geom_pos + geom_field.len, string::npos);
+
+   r.join_idx = JOIN_IDX;
+   r.mbr[0] = env->getMinX();
+   r.mbr[1] = env->getMinY();
+   r.mbr[2] = env->getMaxX();
+   r.mbr[3] = env->getMaxY();
+   r.shape = shape.data();
+   r.shape_len = shape.size();
+   r.payload = payload.data();
+   r.payload_len = payload.size();
+   encodeTileRecord(r, buffer);
+   for (uint32_t i = 0 ; i < hits.size(); i++ ) 
+    {
+	int len = snprintf(tile_id, sizeof(tile_id), "%lld", (long long) hits[i]);
+	writeFrame(cout, tile_id, len);
+	writeFrame(cout, buffer.data(), buffer.size());
+    }
 }
 
+
 int main(int argc, char **argv) {
+  char * program = argv[0];
 
+  if (argc > 1 && strcmp(argv[1], "--binary") == 0) {
+     binary = true;
+     argv++;
+     argc--;
+  }
   if (argc != 6 && argc != 5) {
-     cerr << "ERROR: Not enough arguments. Usage: " << argv[0]
-            << " [geomid1] [geomid2] [partition_file] [prefixpath1] [prefixpath2]" << endl;
+     cerr << "ERROR: Not enough arguments. Usage: " << program
+            << " [--binary] [geomid1] [geomid2] [partition_file] [prefixpath1] [prefixpath2]" << endl;
+     cerr << "  --binary writes binary tile records (Hadoop streaming rawbytes) for resque -b true" << endl;
      return -1;
   }
   //int uid_idx  = args_info.uid_arg;
@@ -272,27 +141,23 @@ int main(int argc, char **argv) {
   // process input data 
   // map<int,Geometry*> geom_polygons;
   string input_line;
-  vector<string> fields;
+  vector<field_t> fields;
   id_type id = 0; 
   Geometry* geom ; 
 
-  genTiles();
-
-  bool ret = buildIndex();
-  if (ret == false) {
-    cerr << "ERROR: Index building on tile structure has failed ." << std::endl;
+  if (!partitions.load(filename)) {
+    cerr << "ERROR: Partition file [" << filename << "] can NOT be loaded." << std::endl;
     return 1 ;
   }
-  else 
 #ifndef NDEBUG  
-    cerr << "GRIDIndex Generated successfully." << endl;
+  cerr << "Partition lookup ready (" << (partitions.isGrid() ? "grid" : "packed R-tree") << ")." << endl;
 #endif
 
 
   cerr << "Reading input from stdin..." <<endl; 
   while(cin && getline(cin, input_line) && !cin.eof()){
-    fields = parse(input_line);
-    if (fields[GEOM_IDX].length() <2 )
+    split(input_line, fields);
+    if (GEOM_IDX >= fields.size() || fields[GEOM_IDX].len <2 )
     {
 #ifndef NDEBUG
       cerr << "skipping record [" << id <<"]"<< endl;
@@ -300,7 +165,7 @@ int main(int argc, char **argv) {
       continue ;  // skip lines which has empty geometry
     }
     // try {
-    geom = wkt_reader->read(fields[GEOM_IDX]);
+    geom = wkt_reader->read(fields[GEOM_IDX].str());
     //}
     /*catch (...)
       {
@@ -310,7 +175,10 @@ int main(int argc, char **argv) {
       }*/
 //     cout << input_line << endl;
      doQuery(geom);
-     emitHits(geom, input_line);
+     if (binary)
+       emitBinaryHits(geom, input_line, fields[GEOM_IDX]);
+     else
+       emitHits(geom, input_line);
      delete geom;
   }
 
@@ -0,0 +1,204 @@
+#ifndef PARTITIONLOOKUP_H
+#define PARTITIONLOOKUP_H
+
+#include <stdint.h>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "tokenizer.h"
+#include "packedindex.h"
+
+/* Read-only lookup of the tiles of a partition file (id TAB min_x TAB
+ * min_y TAB max_x TAB max_y per line) intersecting an MBR, for the
+ * partition mappers. The tile boundaries are kept in a PackedRTree
+ * (packedindex.h). When the tiles form a regular grid, the cells of an
+ * MBR are computed directly instead, by integer division on each axis.
+ * Both give the tiles whose closed boundary intersects the MBR, like the
+ * R-tree on the tile polygons used before. */
+class PartitionLookup
+{
+  public:
+    PartitionLookup() : columns(0), rows(0) {}
+
+    bool load(const char * filename)
+    {
+      std::ifstream partFile(filename);
+      std::string input_line;
+      std::vector<field_t> fields;
+      std::map<long, size_t> pos;
+      if (!partFile)
+        return false;
+
+      while (std::getline(partFile, input_line)) {
+        split(input_line, fields);
+        if (fields.size() < 5)
+          continue;
+        long id = std::strtoul(fields[0].ptr, NULL, 0);
+        packed_box box = { boundary(fields[1]), boundary(fields[2]),
+          boundary(fields[3]), boundary(fields[4]) };
+        // a repeated id replaces the earlier boundary
+        if (pos.count(id) > 0) {
+          boxes[pos[id]] = box;
+          continue;
+        }
+        pos[id] = ids.size();
+        ids.push_back(id);
+        boxes.push_back(box);
+      }
+      if (ids.empty())
+        return false;
+
+      if (!loadGrid()) {
+        PackedRTree::pack(boxes, 16, tree_data);
+        tree.attach(tree_data.data(), tree_data.size());
+      }
+      return true;
+    }
+
+    // tile ids in partition file order
+    const std::vector<long> & tiles() const { return ids; }
+
+    bool isGrid() const { return columns > 0; }
+
+    // replaces hits with the ids of the tiles intersecting the MBR, in increasing order
+    template <class T>
+    void query(double min_x, double min_y, double max_x, double max_y, std::vector<T> & hits) const
+    {
+      hits.clear();
+      if (min_x > max_x || min_y > max_y)
+        return; // empty geometry
+      if (isGrid()) {
+        int x1, x2, y1, y2;
+        if (!cellRange(grid_x, min_x, max_x, x1, x2) || !cellRange(grid_y, min_y, max_y, y1, y2))
+          return;
+        for (int i = x1; i <= x2; i++)
+          for (int j = y1; j <= y2; j++)
+            hits.push_back(cell_ids[i * rows + j]);
+      } else {
+        packed_box q = { min_x, min_y, max_x, max_y };
+        tree.query(q, found);
+        for (size_t k = 0; k < found.size(); k++)
+          hits.push_back(ids[found[k]]);
+        found.clear();
+      }
+      std::sort(hits.begin(), hits.end());
+    }
+
+  private:
+    // tile boundaries go through the same text formatting as the WKT
+    // polygons the mappers used to build, so tiles are assigned as before
+    static double boundary(const field_t & field)
+    {
+      std::stringstream ss;
+      ss << strtod(field.ptr, NULL);
+      return strtod(ss.str().c_str(), NULL);
+    }
+
+    /* Uses direct lookup when every tile is one cell of the grid made of
+     * the distinct tile boundaries, and the cells are evenly spaced, so
+     * integer division lands on (or next to) the right cell. */
+    bool loadGrid()
+    {
+      std::vector<double> xs, ys;
+      for (size_t k = 0; k < boxes.size(); k++) {
+        xs.push_back(boxes[k].min_x);
+        xs.push_back(boxes[k].max_x);
+        ys.push_back(boxes[k].min_y);
+        ys.push_back(boxes[k].max_y);
+      }
+      distinct(xs);
+      distinct(ys);
+      if (xs.size() < 2 || ys.size() < 2
+          || (xs.size() - 1) * (ys.size() - 1) != boxes.size()
+          || !evenlySpaced(xs) || !evenlySpaced(ys))
+        return false;
+
+      int cols = xs.size() - 1;
+      int rws = ys.size() - 1;
+      std::vector<long> cells(boxes.size());
+      std::vector<bool> taken(boxes.size(), false);
+      for (size_t k = 0; k < boxes.size(); k++) {
+        int i = std::lower_bound(xs.begin(), xs.end(), boxes[k].min_x) - xs.begin();
+        int j = std::lower_bound(ys.begin(), ys.end(), boxes[k].min_y) - ys.begin();
+        if (i >= cols || j >= rws || xs[i + 1] != boxes[k].max_x || ys[j + 1] != boxes[k].max_y
+            || taken[i * rws + j])
+          return false;
+        taken[i * rws + j] = true;
+        cells[i * rws + j] = ids[k];
+      }
+
+      grid_x.swap(xs);
+      grid_y.swap(ys);
+      cell_ids.swap(cells);
+      columns = cols;
+      rows = rws;
+      return true;
+    }
+
+    static void distinct(std::vector<double> & values)
+    {
+      std::sort(values.begin(), values.end());
+      values.erase(std::unique(values.begin(), values.end()), values.end());
+    }
+
+    static bool evenlySpaced(const std::vector<double> & grid)
+    {
+      double step = (grid.back() - grid.front()) / (grid.size() - 1);
+      for (size_t k = 1; k < grid.size(); k++)
+        if (fabs(grid[k] - grid[k - 1] - step) > step * 0.01)
+          return false;
+      return true;
+    }
+
+    /* The cells first..last of a grid axis whose closed range meets
+     * [low, high]: integer division, then moved to agree with the
+     * boundaries. Returns false when no cell is met. */
+    static bool cellRange(const std::vector<double> & grid, double low, double high, int & first, int & last)
+    {
+      int cells = grid.size() - 1;
+      if (high < grid[0] || low > grid[cells])
+        return false;
+
+      double step = (grid[cells] - grid[0]) / cells;
+      first = cellOf((low - grid[0]) / step, cells);
+      while (first > 0 && grid[first] >= low)
+        first--;
+      while (first < cells - 1 && grid[first + 1] < low)
+        first++;
+
+      last = cellOf((high - grid[0]) / step, cells);
+      while (last < cells - 1 && grid[last + 1] <= high)
+        last++;
+      while (last > 0 && grid[last] > high)
+        last--;
+      return true;
+    }
+
+    // a cell number clamped to the grid before the conversion to int
+    static int cellOf(double offset, int cells)
+    {
+      if (!(offset > 0))
+        return 0;
+      return offset < cells - 1 ? (int) offset : cells - 1;
+    }
+
+    std::vector<long> ids;
+    std::vector<packed_box> boxes;
+    std::string tree_data;
+    PackedRTree tree;
+    mutable std::vector<uint32_t> found;
+
+    int columns;
+    int rows;
+    std::vector<double> grid_x;
+    std::vector<double> grid_y;
+    std::vector<long> cell_ids;
+};
+
+#endif
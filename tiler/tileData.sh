@@ -12,6 +12,7 @@ usage(){
     --ysplit \t number of splits in the vertical  direction \n \
     --geom \t index of the geometry field \n \
     --uid \t index of the uid field \n \
+    --stream \t [optional] assign objects to tiles as they are read, in a map only job \n \
     --verbose \t [optional] show verbose output \n \
     --help \t show this information.
     "
@@ -31,6 +32,7 @@ ysplit=""
 gidx=""
 uidx=0
 redtasks=20
+stream=""
 
 while :
 do
@@ -128,6 +130,10 @@ do
 	redtasks=${1#*=}        # Delete everything up till "="
 	    shift
 	    ;;
+	-t | --stream)
+	    stream="-t"
+	    shift
+	    ;;
 	-v | --verbose)
 	    # Each instance of -v adds 1 to verbosity
 	    verbose="-verbose"
@@ -179,14 +185,20 @@ if [ ! "$ysplit" ] || [ ! "$xsplit" ]; then
     ysplit=10
 fi
 
-redprog="hgtiler -w ${west}  -s ${south}  -n ${north}  -e ${east}  -x ${xsplit} -y ${ysplit} -u ${uidx} -g ${gidx}"
+redbin=hgtiler
+redprog="${redbin} -w ${west}  -s ${south}  -n ${north}  -e ${east}  -x ${xsplit} -y ${ysplit} -u ${uidx} -g ${gidx}"
 
 echo -e "starting tile job\n" 
 # actual job is performed here
 
 # ./tiler $mapprog
 
-hadoop jar contrib/streaming/hadoop-streaming.jar -mapper 'cat - ' -reducer '${redprog}' -file /usr/bin/cat -file ${redprog} -input ${inputdir} -output ${outputdir} -numReduceTasks ${redtasks} ${verbose} -jobconf mapred.job.name="hadoopgis-TileJob-${inputdir}"  -jobconf mapred.task.timeout=360000000
+if [ "$stream" ]; then
+    # every record is tiled on its own, no need to gather the input in reducers
+    hadoop jar contrib/streaming/hadoop-streaming.jar -mapper "${redprog} ${stream}" -file ${redbin} -input ${inputdir} -output ${outputdir} -numReduceTasks 0 ${verbose} -jobconf mapred.job.name="hadoopgis-TileJob-${inputdir}"  -jobconf mapred.task.timeout=360000000
+else
+    hadoop jar contrib/streaming/hadoop-streaming.jar -mapper 'cat - ' -reducer '${redprog}' -file /usr/bin/cat -file ${redprog} -input ${inputdir} -output ${outputdir} -numReduceTasks ${redtasks} ${verbose} -jobconf mapred.job.name="hadoopgis-TileJob-${inputdir}"  -jobconf mapred.task.timeout=360000000
+fi
  
 succ=$?
 
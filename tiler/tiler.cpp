@@ -1,5 +1,6 @@
 #include "hadoopgis.h"
 #include "cmdline.h"
+#include "wktscan.h"
 
 
 GeometryFactory *gf = NULL;
@@ -13,6 +14,10 @@ char * prefix;
 int GEOM_IDX = -1;
 int ID_IDX = -1;
 
+// streaming mode: the boundaries of the grid columns and rows
+vector<double> grid_x;
+vector<double> grid_y;
+
 bool assignIndex(int uid_idx, int geom_idx) {
     if (uid_idx <1 || geom_idx <1 )
 	return false;
@@ -177,10 +182,103 @@ vector<Geometry*> genTiles(double min_x, double max_x, double min_y, double  max
     return tiles;
 }
 
-vector<string> parse(string & line) {
-    vector<string> tokens ;
-    tokenize(line, tokens,TAB,true);
-    return tokens;
+// a tile coordinate as read back from the WKT text written by genTiles()
+double tileBoundary(double value) {
+    stringstream ss;
+    ss << value;
+    return strtod(ss.str().c_str(), NULL);
+}
+
+void genGrid(double min_x, double max_x, double min_y, double max_y, int x_split, int y_split) {
+    double width =  (max_x - min_x) / x_split;
+    double height = (max_y - min_y)/y_split ;
+
+    for (int i = 0 ; i <= x_split ; i++)
+	grid_x.push_back(tileBoundary(min_x + i * width));
+    for (int j = 0 ; j <= y_split ; j++)
+	grid_y.push_back(tileBoundary(min_y + j * height));
+}
+
+// a cell number clamped to the grid before the conversion to int
+int cellOf(double offset, int cells) {
+    if (!(offset > 0))
+	return 0;
+    return offset < cells - 1 ? (int) offset : cells - 1;
+}
+
+/* The cells first..last of a grid axis whose closed range meets
+ * [low, high]. The cell of each end comes from integer division, then is
+ * moved to agree with the formatted boundaries, so objects get the same
+ * tiles as through the index. Returns false when no cell is met. */
+bool cellRange(const vector<double> & grid, double low, double high, int & first, int & last) {
+    int cells = grid.size() - 1;
+    if (cells < 1 || high < grid[0] || low > grid[cells])
+	return false;
+
+    double step = (grid[cells] - grid[0]) / cells;
+    first = cellOf((low - grid[0]) / step, cells);
+    while (first > 0 && grid[first] >= low)
+	first--;
+    while (first < cells - 1 && grid[first + 1] < low)
+	first++;
+
+    last = cellOf((high - grid[0]) / step, cells);
+    while (last < cells - 1 && grid[last + 1] <= high)
+	last++;
+    while (last > 0 && grid[last] > high)
+	last--;
+    return true;
+}
+
+/* Streaming mode: the tiles of a record follow from its MBR, so records
+ * are written out as they are read, without keeping them or building an
+ * index over them. */
+void streamTiles() {
+    string input_line;
+    vector<field_t> fields;
+    id_type id ;
+    double low[2], high[2];
+    int x1, x2, y1, y2;
+
+    while(cin && getline(cin, input_line) && !cin.eof()){
+	split(input_line, fields);
+	if (ID_IDX >= fields.size() || fields[ID_IDX].len <1 )
+	    continue ;  // skip lines which has empty id field 
+	id = std::strtoul(fields[ID_IDX].ptr, NULL, 0);
+
+	if (GEOM_IDX >= fields.size() || fields[GEOM_IDX].len <2 )
+	    continue ;  // skip lines which has empty geometry
+
+	// the MBR from the WKT text, parsing only when it can not be scanned
+	int scanned = scanEnvelope(fields[GEOM_IDX].ptr, fields[GEOM_IDX].len,
+		low[0], low[1], high[0], high[1]);
+	if (scanned == 0)
+	    continue ;
+	if (scanned < 0) {
+	    Geometry * geom = wkt_reader->read(fields[GEOM_IDX].str());
+	    const Envelope * env = geom->getEnvelopeInternal();
+	    bool empty = geom->isEmpty();
+	    low [0] = env->getMinX();
+	    low [1] = env->getMinY();
+	    high [0] = env->getMaxX();
+	    high [1] = env->getMaxY();
+	    delete geom;
+	    if (empty)
+		continue ;
+	}
+
+	if (!cellRange(grid_x, low[0], high[0], x1, x2) || !cellRange(grid_y, low[1], high[1], y1, y2))
+	    continue ;
+	for (int i = x1 ; i <= x2 ; i++)
+	{
+	    for (int j = y1 ; j <= y2 ; j++)
+	    {
+		if (NULL != prefix) cout << prefix << DASH;
+		cout << grid_x[i] << DASH << grid_y[j] << DASH << grid_x[i+1] << DASH << grid_y[j+1]
+		    << TAB << id << TAB << input_line << '\n' ;
+	    }
+	}
+    }
 }
 
 void freeObjects() {
@@ -300,21 +398,33 @@ int main(int argc, char **argv) {
   wkt_reader= new WKTReader(gf);
 
 
+  if (args_info.stream_flag) {
+    genGrid(min_x, max_x, min_y, max_y, x_split, y_split);
+    cerr << "Number of tiles: " << x_split * y_split << endl;
+    streamTiles();
+
+    cout.flush();
+    cerr.flush();
+    cmdline_parser_free (&args_info); /* release allocated memory */
+    freeObjects();
+    return 0;
+  }
+
   // process input data 
   map<int,Geometry*> geom_polygons;
   string input_line;
-  vector<string> fields;
+  vector<field_t> fields;
   cerr << "Reading input from stdin..." <<endl; 
   id_type id ; 
   Geometry* geom ; 
 
   while(cin && getline(cin, input_line) && !cin.eof()){
-    fields = parse(input_line);
-    if (fields[ID_IDX].length() <1 )
+    split(input_line, fields);
+    if (ID_IDX >= fields.size() || fields[ID_IDX].len <1 )
       continue ;  // skip lines which has empty id field 
-    id = std::strtoul(fields[ID_IDX].c_str(), NULL, 0);
+    id = std::strtoul(fields[ID_IDX].ptr, NULL, 0);
 
-    if (fields[GEOM_IDX].length() <2 )
+    if (GEOM_IDX >= fields.size() || fields[GEOM_IDX].len <2 )
     {
 #ifndef NDEBUG
       cerr << "skipping record [" << id <<"]"<< endl;
@@ -322,7 +432,7 @@ int main(int argc, char **argv) {
       continue ;  // skip lines which has empty geometry
     }
     // try {
-    geom = wkt_reader->read(fields[GEOM_IDX]);
+    geom = wkt_reader->read(fields[GEOM_IDX].str());
     //}
     /*catch (...)
       {
@@ -0,0 +1,95 @@
+#ifndef TILERECORD_H
+#define TILERECORD_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <istream>
+#include <ostream>
+
+/* Binary tile records from partitionMapperJoin to resque, written as
+ * Hadoop streaming "rawbytes" frames: a 4 byte big endian length and the
+ * bytes, first for the key and then for the value. The key is the tile
+ * id as text, the value is
+ *
+ *   int32   dataset (join) index
+ *   double  min_x, min_y, max_x, max_y of the geometry
+ *   uint32  length of the geometry, then the geometry as WKB
+ *   uint32  length of the payload, then the payload: the fields of the
+ *           input record, tab separated, with the geometry field empty
+ *
+ * Numbers are in the native byte order of the mapper (WKB records its
+ * own), so mappers and reducers must share the architecture. */
+struct tile_record {
+  int32_t join_idx;
+  double mbr[4];
+  const char * shape;
+  uint32_t shape_len;
+  const char * payload;
+  uint32_t payload_len;
+};
+
+inline void writeFrame(std::ostream & out, const char * data, uint32_t len)
+{
+  char size[4];
+  size[0] = (char) (len >> 24);
+  size[1] = (char) (len >> 16);
+  size[2] = (char) (len >> 8);
+  size[3] = (char) len;
+  out.write(size, 4);
+  out.write(data, len);
+}
+
+// false at the end of the input or on a truncated frame
+inline bool readFrame(std::istream & in, std::string & data)
+{
+  unsigned char size[4];
+  if (!in.read(reinterpret_cast<char*>(size), 4))
+    return false;
+  uint32_t len = (uint32_t) size[0] << 24 | (uint32_t) size[1] << 16
+      | (uint32_t) size[2] << 8 | (uint32_t) size[3];
+  data.resize(len);
+  return len == 0 || in.read(&data[0], len);
+}
+
+/* Encodes the value of a record into value. An object copied to several
+ * tiles is encoded once, and the value is written after each tile id. */
+inline void encodeTileRecord(const tile_record & r, std::string & value)
+{
+  value.clear();
+  value.append(reinterpret_cast<const char*>(&r.join_idx), sizeof(r.join_idx));
+  value.append(reinterpret_cast<const char*>(r.mbr), sizeof(r.mbr));
+  value.append(reinterpret_cast<const char*>(&r.shape_len), sizeof(r.shape_len));
+  value.append(r.shape, r.shape_len);
+  value.append(reinterpret_cast<const char*>(&r.payload_len), sizeof(r.payload_len));
+  value.append(r.payload, r.payload_len);
+}
+
+/* Decodes the value of a frame. The geometry and the payload point into
+ * value. Returns false when the value is truncated. */
+inline bool readTileRecord(const std::string & value, tile_record & r)
+{
+  const char * pos = value.data();
+  const char * end = pos + value.size();
+
+  if (end - pos < (long) (sizeof(r.join_idx) + sizeof(r.mbr) + sizeof(r.shape_len)))
+    return false;
+  memcpy(&r.join_idx, pos, sizeof(r.join_idx));
+  pos += sizeof(r.join_idx);
+  memcpy(r.mbr, pos, sizeof(r.mbr));
+  pos += sizeof(r.mbr);
+  memcpy(&r.shape_len, pos, sizeof(r.shape_len));
+  pos += sizeof(r.shape_len);
+  if ((size_t) (end - pos) < (size_t) r.shape_len + sizeof(r.payload_len))
+    return false;
+  r.shape = pos;
+  pos += r.shape_len;
+  memcpy(&r.payload_len, pos, sizeof(r.payload_len));
+  pos += sizeof(r.payload_len);
+  if ((size_t) (end - pos) < (size_t) r.payload_len)
+    return false;
+  r.payload = pos;
+  return true;
+}
+
+#endif